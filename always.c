@@ -23,7 +23,61 @@
 
    always - Run a command and restart it if it dies
 
-   USAGE: always path/to/command args...
+   USAGE: always [options] path/to/command args...
+          always -v
+
+   Options control when (and how quickly) the command is restarted:
+
+     -s SECONDS    A run that lasts at least this long is considered
+                   stable, and the command is restarted immediately.
+                   Faster deaths incur a backoff.  Defaults to 2.
+     -b SECONDS    The first backoff.  Each successive too-quick death
+                   doubles it.  Defaults to 1.
+     -B SECONDS    Backoff never grows beyond this.  Defaults to 5.
+     -j FRACTION   Randomly shave up to this fraction (0 - 1) off of
+                   each backoff, so that a fleet of crashing commands
+                   don't all come back at once.  Defaults to 0.
+     -r N/SECONDS  Give up (and exit 2) if the command would have been
+                   restarted more than N times in SECONDS.
+     -e CODES      Only restart if the command exits with one of these
+                   exit codes (i.e. "1,2,10-20").  Commands killed by
+                   signals are always restarted.
+     -E CODES      Never restart if the command exits with one of these
+                   exit codes (i.e. "-E 0" to stop on success).
+
+   Signals are handled as follows:
+
+     -f SIGNALS    Pass these signals (i.e. "HUP,USR1,USR2", which is
+                   the default) on to the command, as-is.
+     -t SECONDS    A SIGTERM or SIGINT stops always: the signal is passed
+                   on to the command, which will not be restarted once it
+                   exits.  If it hasn't exited within SECONDS (default 10)
+                   or if a second stop signal arrives, it is SIGKILLed.
+     -H            Restart the command on SIGHUP, without any gap: start
+                   the new process first, and then stop the old one (with
+                   a SIGTERM, and the same deadline as for stopping).
+
+   The command's health can be checked periodically, too:
+
+     -p PROBE      How to check: exec:COMMAND (healthy if it exits 0),
+                   tcp:HOST:PORT or unix:PATH (healthy if a connect()
+                   works), or file:PATH (healthy if PATH's mtime has
+                   changed since the last check; i.e. a heartbeat).
+     -i SECONDS    How often to check.  Defaults to 5.
+     -T SECONDS    How long a check can take before it counts as a
+                   failure.  Defaults to the interval.
+     -n N          How many failed checks in a row it takes to restart
+                   the command (SIGTERM, then SIGKILL after the -t
+                   deadline).  Defaults to 3.
+     -g SECONDS    Failed checks don't count until the command has passed
+                   a check, or this long after it starts.  Defaults to
+                   -i times -n.
+
+   With a probe, -H waits for the new process to pass its first check
+   before stopping the old one; if it dies first, the old one stays.
+   Probe results and latencies are logged to file descriptor 3.
+
+   If the command isn't restarted, always exits with its exit code.
 
  */
 
@@ -31,99 +85,923 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <strings.h>
+#include <signal.h>
 #include <time.h>
 #include <fcntl.h>
+#include <netdb.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
 #define PROGRAM "always"
 
-#define TOOFAST 2
-#define RESPAWN 5
+#define TOOFAST 2    /* a child that dies this quickly (seconds) */
+                     /* gets restarted only after a backoff      */
+#define BACKOFF 1    /* first backoff, in seconds                */
+#define RESPAWN 5    /* longest backoff, in seconds              */
+#define GRACE   10   /* how long to wait (seconds) on a stopping */
+                     /* child before sending it a SIGKILL        */
+#define INTERVAL 5   /* seconds between health probes           */
+#define FAILURES 3   /* failed probes in a row before a restart  */
+
+/*
+   The restart policy, as given on the command line.  All of
+   the times are in milliseconds.
+ */
+static struct {
+	long stable;      /* runs this long reset the backoff    */
+	long backoff;     /* initial backoff                     */
+	long max;         /* backoff never gets longer than this */
+	double jitter;    /* shave up to this fraction off       */
+
+	int limit;        /* at most this many restarts...       */
+	long window;      /* ... within this many ms (0 = any)   */
+
+	char only[256];   /* restart only on these exit codes    */
+	char never[256];  /* never restart on these exit codes   */
+	int filtered;     /* was -e given?                       */
+
+	long grace;       /* stop deadline, before SIGKILL       */
+	int rehup;        /* SIGHUP means hand off (-H)          */
+} policy;
 
 static void
 usage(int rc)
 {
-	fprintf(stderr, "USAGE: " PROGRAM " path/to/command args...\n");
+	fprintf(stderr, "USAGE: " PROGRAM " [-b SECONDS] [-B SECONDS] [-j FRACTION] [-s SECONDS]\n"
+	                "              [-r N/SECONDS] [-e CODES] [-E CODES]\n"
+	                "              [-f SIGNALS] [-t SECONDS] [-H]\n"
+	                "              [-p PROBE] [-i SECONDS] [-T SECONDS] [-n N] [-g SECONDS]\n"
+	                "              path/to/command args...\n");
 	exit(rc);
 }
 
-int main(int argc, char **argv)
+static long
+ms(const char *flag, const char *v)
 {
-	pid_t pid, kid;
-	int rc;
-	FILE *debug;
-	struct timespec now, last;
+	char *end;
+	double d;
 
-	if (argc < 2) usage(EXIT_IMPROPER);
-	if (argv[1][0] == '-') {
-		if (eq(argv[1], "-v")) show_version(PROGRAM);
-		if (eq(argv[1], "-h")) usage(EXIT_OK);
-		usage(EXIT_IMPROPER);
+	d = strtod(v, &end);
+	if (*end || end == v || d < 0 || d > 86400 * 365) {
+		fprintf(stderr, PROGRAM ": invalid value '%s' for %s (should be a number of seconds)\n", v, flag);
+		exit(EXIT_IMPROPER);
 	}
+	return (long)(d * 1000);
+}
 
-	if (fcntl(3, F_GETFD) >= 0) {
-		debug = fdopen(3, "w");
-	} else {
-		debug = fopen("/dev/null", "w");
-	}
+/*
+   Parse a list of exit codes, like "1,2,10-20", flagging each
+   one in `set`.
+ */
+static void
+codes(const char *flag, const char *v, char *set)
+{
+	const char *p, *q;
+	char *end;
+	long a, b;
 
-	if (!freopen("/dev/null", "r", stdin)) {
-		fprintf(stderr, PROGRAM ": failed to redirect /dev/null into stdin\n");
-		fclose(stdin);
+	for (p = v; *p; p = end + (*end == ',')) {
+		a = b = strtol(p, &end, 10);
+		q = NULL;
+		if (end != p && *end == '-') {
+			/* both ends of a range are required (no `0-') */
+			q = end + 1;
+			b = strtol(q, &end, 10);
+		}
+		if (end == p || end == q || (*end && *end != ',') || a < 0 || b > 255 || a > b) {
+			fprintf(stderr, PROGRAM ": invalid exit code list '%s' for %s\n", v, flag);
+			exit(EXIT_IMPROPER);
+		}
+		for (; a <= b; a++)
+			set[a] = 1;
 	}
-	memset(&last, 0, sizeof(last));
+}
 
-reexec:
-	clock_gettime(CLOCK_MONOTONIC, &last);
+static long
+now(void)
+{
+	return (long)(rig_now() / 1000000);
+}
 
-	pid = fork();
+/*
+   Arm the (one-shot) timer to go off in `delay` milliseconds,
+   or disarm it, if `delay` is negative.
+ */
+static void
+arm(int tfd, long delay)
+{
+	if (rig_arm(tfd, delay < 0 ? -1 : delay * 1000000LL, 0, 0) != 0)
+		fprintf(stderr, PROGRAM ": failed to set timer: %s (error %d)\n", strerror(errno), errno);
+}
+
+static pid_t
+spawn(char **argv, const sigset_t *mask, FILE *debug)
+{
+	pid_t pid;
+
+	pid = rig_spawn(PROGRAM, argv, mask, NULL);
 	if (pid < 0) {
 		fprintf(stderr, PROGRAM ": fork() failed: %s (error %d)\n", strerror(errno), errno);
-		sleep(5);
-		goto reexec;
+		return -1;
 	}
-	if (pid == 0) {
-		execvp(argv[1], &argv[1]);
-		fprintf(stderr, PROGRAM ": failed to exec '%s': %s (error %d)\n", argv[1], strerror(errno), errno);
-		exit(EXIT_IN_CHILD);
+	fprintf(debug, PROGRAM ": forked child process %d to run '%s'\n", pid, argv[0]);
+	return pid;
+}
+
+/*
+   Signals, by name, for -f.
+ */
+static const struct {
+	const char *name;
+	int         signo;
+} SIGNALS[] = {
+	{ "HUP",   SIGHUP  },
+	{ "INT",   SIGINT  },
+	{ "QUIT",  SIGQUIT },
+	{ "USR1",  SIGUSR1 },
+	{ "USR2",  SIGUSR2 },
+	{ "ALRM",  SIGALRM },
+	{ "TERM",  SIGTERM },
+	{ "WINCH", SIGWINCH },
+	{ NULL, 0 },
+};
+
+/*
+   Parse a list of signal names (i.e. "HUP,USR1,USR2") into
+   `set`.  The SIG prefix is optional, and case is ignored.
+ */
+static void
+signals(const char *v, sigset_t *set)
+{
+	char buf[256], *tok, *save;
+	int i;
+
+	if (strlen(v) >= sizeof(buf)) {
+		fprintf(stderr, PROGRAM ": signal list '%s' is too long\n", v);
+		exit(EXIT_IMPROPER);
 	}
-	fprintf(debug, PROGRAM ": forked child process %d to run '%s'\n", pid, argv[1]);
+	strcpy(buf, v);
 
-	for (;;) {
-		kid = waitpid(-1, &rc, 0);
-		if (kid < 0) {
-			fprintf(stderr, PROGRAM ": failed to waitpid(-1): %s (error %d)\n", strerror(errno), errno);
+	sigemptyset(set);
+	for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		if (strncasecmp(tok, "SIG", 3) == 0)
+			tok += 3;
+		for (i = 0; SIGNALS[i].name; i++)
+			if (strcasecmp(tok, SIGNALS[i].name) == 0)
+				break;
+		if (!SIGNALS[i].name) {
+			fprintf(stderr, PROGRAM ": unrecognized signal '%s'\n", tok);
+			exit(EXIT_IMPROPER);
+		}
+		sigaddset(set, SIGNALS[i].signo);
+	}
+}
+
+/*
+   Health probes (-p) come in four kinds:
+
+     exec:COMMAND ARGS...   healthy if COMMAND exits 0
+     tcp:HOST:PORT          healthy if we can connect
+     unix:/PATH             healthy if we can connect
+     file:/PATH             healthy if PATH's mtime has moved on
+                            since the last probe (a heartbeat)
+ */
+#define PROBE_EXEC 1
+#define PROBE_TCP  2
+#define PROBE_UNIX 3
+#define PROBE_FILE 4
+
+static struct {
+	int kind;                /* PROBE_*; 0 = no probe       */
+	char **argv;             /* for exec probes             */
+	struct sockaddr_storage addr;  /* for tcp / unix probes */
+	socklen_t addrlen;
+	const char *path;        /* for file probes             */
+
+	long interval;           /* ms between probes           */
+	long timeout;            /* ms before a probe fails     */
+	long grace;              /* ms after start before fails */
+	                         /* count (unless it's ready)   */
+	int failures;            /* fails in a row to restart   */
+} probe;
+
+/*
+   The state of the world: what's running, and what we're
+   in the middle of doing about it.
+ */
+static struct {
+	char **argv;      /* the command to (re-)run           */
+	sigset_t mask;    /* signals we handle via the signalfd */
+	FILE *debug;      /* fd 3, or /dev/null                 */
+
+	pid_t pid;        /* the child; 0 if not running        */
+	pid_t old;        /* a child being handed off from (-H) */
+	int pidfd, oldfd; /* ... and their pidfds (or -1)       */
+	int handing;      /* waiting on `pid` to be ready, so   */
+	                  /* that we can retire `old`           */
+	long started;     /* when `pid` was started             */
+	int status;       /* how `pid` last exited              */
+
+	int stopping;     /* the stop signal we got, if any     */
+	int unhealthy;    /* are we restarting `pid` for -p?    */
+	int fails;        /* too-quick deaths in a row          */
+	unsigned long n;  /* restarts so far (for -r)           */
+	long *restarts;   /* ring of the last -r restart times  */
+
+	int null;         /* /dev/null, for exec probes' stdout */
+
+	int timer;        /* timerfd for restart backoffs       */
+	int deadline;     /* timerfd for escalating to SIGKILL  */
+
+	int tick;         /* timerfd for running probes         */
+	int expiry;       /* timerfd for probe timeouts         */
+	pid_t checker;    /* a running exec probe               */
+	int sock;         /* a connecting tcp / unix probe      */
+	long long sent;   /* when the running probe started     */
+	time_t mtime;     /* last heartbeat mtime (file probe)  */
+	long mnsec;
+
+	int ready;        /* has `pid` passed a probe yet?      */
+	int failed;       /* failed probes in a row             */
+	unsigned long probes, bad;           /* probe counts    */
+	double last, avg, max;               /* latencies (ms)  */
+} my;
+
+static pid_t
+start(void)
+{
+	my.started = now();
+	my.ready = my.failed = 0;
+	my.pid = spawn(my.argv, &my.mask, my.debug);
+	if (my.pid < 0) {
+		my.pid = 0;
+		arm(my.timer, policy.max);
+	}
+	my.pidfd = my.pid ? rig_pidfd(my.pid) : -1;
+	return my.pid;
+}
+
+/*
+   Begin stopping: pass `sig` on to the child (and any child we
+   are handing off from), and give them until the deadline to
+   exit.  A second stop signal skips straight to SIGKILL.
+ */
+static void
+stop(int sig)
+{
+	if (!my.pid && !my.old)
+		exit(EXIT_OK);
+
+	if (my.stopping) {
+		fprintf(my.debug, PROGRAM ": stop requested again; killing child process\n");
+		arm(my.deadline, 0);
+		return;
+	}
+
+	fprintf(my.debug, PROGRAM ": stopping child process %d\n", my.pid);
+	my.stopping = sig;
+	if (my.pid) rig_kill(my.pid, my.pidfd, sig);
+	if (my.old) rig_kill(my.old, my.oldfd, SIGTERM);
+	arm(my.deadline, policy.grace);
+}
+
+/*
+   Retire the process we are handing off from (-H).
+ */
+static void
+retire(void)
+{
+	my.handing = 0;
+	if (!my.old)
+		return; /* already gone (see reap()) */
+	fprintf(my.debug, PROGRAM ": handing off from process %d to %d\n", my.old, my.pid);
+	rig_kill(my.old, my.oldfd, SIGTERM);
+	arm(my.deadline, policy.grace);
+}
+
+/*
+   Start a new child, and then retire the old one (-H).  There
+   is never a moment when nothing is running.  With a health
+   probe, the old child keeps running until the new one passes
+   its first probe; if it never does, we stick with the old one.
+ */
+static void
+handoff(void)
+{
+	if (my.old) {
+		fprintf(my.debug, PROGRAM ": still handing off from process %d; ignoring SIGHUP\n", my.old);
+		return;
+	}
+	if (!my.pid) {
+		/* nothing to hand off from; cut the backoff short */
+		arm(my.timer, 0);
+		return;
+	}
+
+	my.old = my.pid;
+	my.oldfd = my.pidfd;
+	if (!start()) {
+		my.pid = my.old;
+		my.pidfd = my.oldfd;
+		my.old = 0;
+		my.oldfd = -1;
+		my.ready = 1;
+		return;
+	}
+
+	if (probe.kind) {
+		my.handing = 1;
+		fprintf(my.debug, PROGRAM ": waiting for process %d to be ready\n", my.pid);
+		return;
+	}
+	retire();
+}
+
+/*
+   Kick off a probe of the child's health.  File probes finish
+   right away; the others finish when the checker exits, or when
+   the socket connects, or when the probe times out.
+ */
+static int settle(int ok, const char *why);
+static void connected(int fd, unsigned events, void *data);
+
+static void
+check(void)
+{
+	struct stat st;
+	pid_t pid;
+	int rc, fds[3];
+
+	if (!my.pid || my.checker || my.sock >= 0)
+		return;
+
+	my.sent = rig_now();
+	switch (probe.kind) {
+	case PROBE_FILE:
+		if (stat(probe.path, &st) != 0) {
+			settle(0, strerror(errno));
+			return;
+		}
+		rc = st.st_mtim.tv_sec != my.mtime || st.st_mtim.tv_nsec != my.mnsec;
+		my.mtime = st.st_mtim.tv_sec;
+		my.mnsec = st.st_mtim.tv_nsec;
+		settle(rc, "heartbeat is stale");
+		return;
+
+	case PROBE_EXEC:
+		fds[0] = fds[2] = -1;
+		fds[1] = my.null;
+		pid = rig_spawn(PROGRAM, probe.argv, &my.mask, fds);
+		if (pid < 0) {
+			settle(0, strerror(errno));
+			return;
+		}
+		my.checker = pid;
+		break;
+
+	case PROBE_TCP:
+	case PROBE_UNIX:
+		my.sock = socket(probe.addr.ss_family, SOCK_STREAM, 0);
+		if (my.sock < 0) {
+			settle(0, strerror(errno));
+			return;
+		}
+		fcntl(my.sock, F_SETFD, FD_CLOEXEC);
+		fcntl(my.sock, F_SETFL, O_NONBLOCK);
+		if (connect(my.sock, (struct sockaddr *)&probe.addr, probe.addrlen) == 0) {
+			close(my.sock);
+			my.sock = -1;
+			settle(1, NULL);
+			return;
+		}
+		if (errno != EINPROGRESS) {
+			close(my.sock);
+			my.sock = -1;
+			settle(0, strerror(errno));
+			return;
+		}
+		if (rig_watch(my.sock, EPOLLOUT, connected, NULL) != 0) {
+			close(my.sock);
+			my.sock = -1;
+			settle(0, strerror(errno));
+			return;
+		}
+		break;
+	}
+	arm(my.expiry, probe.timeout);
+}
+
+/*
+   A non-blocking connect() finished, one way or the other.
+ */
+static void
+connected(int fd, unsigned events, void *data)
+{
+	int err;
+	socklen_t len = sizeof(err);
+
+	(void)fd; (void)events; (void)data;
+	if (getsockopt(my.sock, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+		err = errno;
+	rig_unwatch(my.sock);
+	close(my.sock);
+	my.sock = -1;
+	settle(err == 0, strerror(err));
+}
+
+/*
+   Record the outcome of a probe (and how long it took), and
+   act on it: the first success makes the child ready; enough
+   failures in a row get it restarted.  Failures during the
+   start-up grace period don't count, until it's been ready.
+ */
+static int
+settle(int ok, const char *why)
+{
+	double lat;
+
+	arm(my.expiry, -1);
+	if (!my.pid)
+		return 0; /* too late; it's already gone */
+
+	lat = (rig_now() - my.sent) / 1e6;
+	my.probes++;
+	my.last = lat;
+	my.avg  = my.probes == 1 ? lat : my.avg * 0.8 + lat * 0.2;
+	if (lat > my.max)
+		my.max = lat;
+
+	if (ok) {
+		fprintf(my.debug, PROGRAM ": probe ok in %.3fms (avg %.3fms, max %.3fms)\n", lat, my.avg, my.max);
+		my.failed = 0;
+		if (!my.ready) {
+			my.ready = 1;
+			fprintf(my.debug, PROGRAM ": process %d is ready\n", my.pid);
+			if (my.handing)
+				retire();
+		}
+		return 1;
+	}
+
+	my.bad++;
+	if (!my.ready && now() - my.started < probe.grace) {
+		fprintf(my.debug, PROGRAM ": probe failed in %.3fms (%s); process %d still starting up\n", lat, why, my.pid);
+		return 0;
+	}
+
+	my.failed++;
+	fprintf(stderr, PROGRAM ": probe failed in %.3fms (%s); %d of %d\n", lat, why, my.failed, probe.failures);
+	if (my.failed >= probe.failures && !my.unhealthy && !my.stopping) {
+		fprintf(stderr, PROGRAM ": process %d is unhealthy; restarting it\n", my.pid);
+		my.unhealthy = 1;
+		rig_kill(my.pid, my.pidfd, SIGTERM);
+		arm(my.deadline, policy.grace);
+	}
+	return 0;
+}
+
+/*
+   The probe ran out of time.
+ */
+static void
+expired(void)
+{
+	if (my.checker) {
+		kill(my.checker, SIGKILL);
+		my.checker = 0;
+	}
+	if (my.sock >= 0) {
+		rig_unwatch(my.sock);
+		close(my.sock);
+		my.sock = -1;
+	}
+	settle(0, "timed out");
+}
+
+/*
+   Parse the -p argument into `probe`.
+ */
+static void
+probing(const char *v)
+{
+	struct sockaddr_un *un;
+	struct addrinfo hints, *ai;
+	char *copy, *host, *port, *tok, *save;
+	int n, rc;
+
+	if (strncmp(v, "exec:", 5) == 0) {
+		probe.kind = PROBE_EXEC;
+		copy = strdup(v + 5);
+		probe.argv = calloc(strlen(v) / 2 + 2, sizeof(char *));
+		if (!copy || !probe.argv)
+			goto oom;
+		n = 0;
+		for (tok = strtok_r(copy, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save))
+			probe.argv[n++] = tok;
+		if (n == 0)
+			goto bad;
+
+	} else if (strncmp(v, "file:", 5) == 0) {
+		probe.kind = PROBE_FILE;
+		probe.path = v + 5;
+		if (!*probe.path)
+			goto bad;
+
+	} else if (strncmp(v, "unix:", 5) == 0) {
+		probe.kind = PROBE_UNIX;
+		un = (struct sockaddr_un *)&probe.addr;
+		if (!v[5] || strlen(v + 5) >= sizeof(un->sun_path))
+			goto bad;
+		un->sun_family = AF_UNIX;
+		strcpy(un->sun_path, v + 5);
+		probe.addrlen = sizeof(struct sockaddr_un);
+
+	} else if (strncmp(v, "tcp:", 4) == 0) {
+		probe.kind = PROBE_TCP;
+		copy = strdup(v + 4);
+		if (!copy)
+			goto oom;
+		port = strrchr(copy, ':');
+		if (!port || port == copy || !port[1])
+			goto bad;
+		*port++ = '\0';
+		host = copy;
+		if (*host == '[' && host[strlen(host) - 1] == ']') {
+			host[strlen(host) - 1] = '\0';
+			host++;
+		}
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_socktype = SOCK_STREAM;
+		rc = getaddrinfo(host, port, &hints, &ai);
+		if (rc != 0) {
+			fprintf(stderr, PROGRAM ": failed to resolve '%s' for -p: %s\n", v, gai_strerror(rc));
+			exit(EXIT_IMPROPER);
+		}
+		memcpy(&probe.addr, ai->ai_addr, ai->ai_addrlen);
+		probe.addrlen = ai->ai_addrlen;
+		freeaddrinfo(ai);
+		free(copy);
+
+	} else {
+		goto bad;
+	}
+	return;
+
+bad:
+	fprintf(stderr, PROGRAM ": invalid probe '%s' (try exec:CMD, tcp:HOST:PORT, unix:PATH or file:PATH)\n", v);
+	exit(EXIT_IMPROPER);
+oom:
+	fprintf(stderr, PROGRAM ": out of memory\n");
+	exit(EXIT_RUNTIME);
+}
+
+static void
+died(pid_t kid, int rc)
+{
+	fprintf(stderr, PROGRAM ": process %d %s\n", kid, rig_status(rc));
+}
+
+/*
+   Let go of a child's pidfd, once it's been reaped.
+ */
+static void
+drop(int *pidfd)
+{
+	if (*pidfd >= 0)
+		close(*pidfd);
+	*pidfd = -1;
+}
+
+/*
+   Decide what to do about the child having exited with `rc`:
+   give up, restart it right away, or restart it after a backoff.
+ */
+static void
+restart(int rc)
+{
+	long delay;
+	int i;
+
+	if (!my.unhealthy && WIFEXITED(rc) && WEXITSTATUS(rc) != EXIT_IN_CHILD
+	 && (policy.never[WEXITSTATUS(rc)] || (policy.filtered && !policy.only[WEXITSTATUS(rc)]))) {
+		fprintf(stderr, PROGRAM ": not restarting after rc=%d\n", WEXITSTATUS(rc));
+		exit(WEXITSTATUS(rc));
+	}
+	my.unhealthy = 0;
+
+	if (policy.limit) {
+		/* restarts[] is a ring of the last `limit` restarts */
+		long t = now(), oldest = my.restarts[my.n % policy.limit];
+		if (my.n >= (unsigned long)policy.limit && (!policy.window || t - oldest < policy.window)) {
+			fprintf(stderr, PROGRAM ": restarted %d times in %.1fs; giving up\n",
+				policy.limit, (t - oldest) / 1000.0);
+			exit(EXIT_RUNTIME);
+		}
+		my.restarts[my.n++ % policy.limit] = t;
+	}
+
+	/* exponential backoff for children that die too
+	   quickly; a stable run resets the backoff. */
+	if (now() - my.started >= policy.stable) {
+		my.fails = 0;
+		delay = 0;
+	} else {
+		delay = policy.backoff;
+		for (i = 0; i < my.fails && delay < policy.max; i++)
+			delay *= 2;
+		if (delay > policy.max)
+			delay = policy.max;
+		delay -= (long)(delay * policy.jitter * (rand() / (RAND_MAX + 1.0)));
+		my.fails++;
+		fprintf(stderr, PROGRAM ": process dying too quickly; waiting %.3f seconds to respawn...\n", delay / 1000.0);
+	}
+	rig_trace(restart, delay, my.fails);
+	arm(my.timer, delay);
+}
+
+static void
+reap(void)
+{
+	pid_t kid;
+	int rc;
+
+	while ((kid = waitpid(-1, &rc, WNOHANG)) > 0) {
+		rig_trace(exit, kid, rc);
+		if (kid == my.checker) {
+			my.checker = 0;
+			settle(WIFEXITED(rc) && WEXITSTATUS(rc) == 0, "probe command failed");
+
+		} else if (kid == my.old) {
+			died(kid, rc);
+			drop(&my.oldfd);
+			my.old = 0;
+			if (my.handing) {
+				/* it didn't wait for the new one to be ready;
+				   the new one is all we've got, ready or not */
+				fprintf(stderr, PROGRAM ": process %d exited mid-handoff; going with process %d\n", kid, my.pid);
+				my.handing = 0;
+			}
+			if (!my.stopping) {
+				fprintf(my.debug, PROGRAM ": handoff to process %d complete\n", my.pid);
+				arm(my.deadline, -1);
+			}
+
+		} else if (kid == my.pid && my.handing && my.old) {
+			/* the new one never got ready; keep the old one */
+			died(kid, rc);
+			fprintf(stderr, PROGRAM ": handoff failed; sticking with process %d\n", my.old);
+			drop(&my.pidfd);
+			my.pid = my.old;
+			my.pidfd = my.oldfd;
+			my.oldfd = -1;
+			my.old = my.handing = my.unhealthy = 0;
+			my.ready = 1;
+			my.failed = 0;
+
+		} else if (kid == my.pid) {
+			died(kid, rc);
+			drop(&my.pidfd);
+			my.pid = my.handing = 0;
+			my.status = rc;
+			if (!my.stopping)
+				restart(rc);
+		}
+	}
+
+	if (my.stopping && !my.pid && !my.old) {
+		if (WIFEXITED(my.status)) exit(WEXITSTATUS(my.status));
+		exit(WIFSIGNALED(my.status) && WTERMSIG(my.status) == my.stopping ? EXIT_OK : EXIT_RUNTIME);
+	}
+}
+
+/*
+   Handlers for the main loop: one for the signalfd, and one
+   for each of the timers.
+ */
+static void
+signalled(int fd, unsigned events, void *data)
+{
+	int sig;
+
+	(void)events; (void)data;
+	while ((sig = rig_signal(fd)) != 0) {
+		switch (sig) {
+		case SIGCHLD:
+			break;
+
+		case SIGTERM:
+		case SIGINT:
+			stop(sig);
+			break;
+
+		case SIGHUP:
+			if (policy.rehup) {
+				if (!my.stopping) handoff();
+				break;
+			}
+			/* fall through */
+
+		default:
+			if (my.pid)
+				rig_kill(my.pid, my.pidfd, sig);
 			break;
 		}
+	}
+	reap();
+}
 
-		if (kid == pid) {
-			if (WIFEXITED(rc) && WEXITSTATUS(rc) != EXIT_IN_CHILD) {
-				fprintf(stderr, PROGRAM ": process %d exited with rc=%d\n", kid, WEXITSTATUS(rc));
+static void
+backedoff(int fd, unsigned events, void *data)
+{
+	(void)events; (void)data;
+	if (rig_ticks(fd) > 0 && !my.pid && !my.stopping)
+		start();
+}
 
-			} else if (WIFSIGNALED(rc)) {
-				fprintf(stderr, PROGRAM ": process %d killed with signal %d\n", kid, WTERMSIG(rc));
+static void
+overdue(int fd, unsigned events, void *data)
+{
+	(void)events; (void)data;
+	if (rig_ticks(fd) <= 0)
+		return;
+	if (my.old && !my.handing) {
+		fprintf(stderr, PROGRAM ": process %d took too long to exit; killing it\n", my.old);
+		rig_kill(my.old, my.oldfd, SIGKILL);
+	}
+	if (my.pid && (my.stopping || my.unhealthy)) {
+		fprintf(stderr, PROGRAM ": process %d took too long to exit; killing it\n", my.pid);
+		rig_kill(my.pid, my.pidfd, SIGKILL);
+	}
+}
 
-			} else {
-				fprintf(stderr, PROGRAM ": process %d died with unrecognized status of %d (%08x)\n", kid, rc, rc);
+static void
+ticked(int fd, unsigned events, void *data)
+{
+	(void)events; (void)data;
+	if (rig_ticks(fd) > 0)
+		check();
+}
+
+static void
+timedout(int fd, unsigned events, void *data)
+{
+	(void)events; (void)data;
+	if (rig_ticks(fd) > 0)
+		expired();
+}
+
+int main(int argc, char **argv)
+{
+	int opt, sfd;
+	char *end;
+	sigset_t forward;
+
+	policy.stable  = TOOFAST * 1000;
+	policy.backoff = BACKOFF * 1000;
+	policy.max     = RESPAWN * 1000;
+	policy.grace   = GRACE * 1000;
+
+	probe.interval = INTERVAL * 1000;
+	probe.timeout  = -1;
+	probe.grace    = -1;
+	probe.failures = FAILURES;
+
+	sigemptyset(&forward);
+	sigaddset(&forward, SIGHUP);
+	sigaddset(&forward, SIGUSR1);
+	sigaddset(&forward, SIGUSR2);
+
+	if (argc > 1 && eq(argv[1], "-v")) show_version(PROGRAM);
+	while ((opt = getopt(argc, argv, "+hb:B:j:s:r:e:E:f:t:Hp:i:T:n:g:")) != -1) {
+		switch (opt) {
+		case 'h': usage(EXIT_OK);
+		case 'b': policy.backoff = ms("-b", optarg); break;
+		case 'B': policy.max     = ms("-B", optarg); break;
+		case 's': policy.stable  = ms("-s", optarg); break;
+		case 't': policy.grace   = ms("-t", optarg); break;
+		case 'f': signals(optarg, &forward); break;
+		case 'H': policy.rehup = 1; break;
+
+		case 'p': probing(optarg); break;
+		case 'i': probe.interval = ms("-i", optarg); break;
+		case 'T': probe.timeout  = ms("-T", optarg); break;
+		case 'g': probe.grace    = ms("-g", optarg); break;
+		case 'n':
+			probe.failures = (int)strtol(optarg, &end, 10);
+			if (*end || end == optarg || probe.failures < 1) {
+				fprintf(stderr, PROGRAM ": invalid failure count '%s' for -n\n", optarg);
+				exit(EXIT_IMPROPER);
 			}
+			break;
 
-			rc = clock_gettime(CLOCK_MONOTONIC, &now);
-			if (rc < 0) {
-				fprintf(stderr, PROGRAM ": failed to get current time: %s (error %d)\n", strerror(errno), errno);
-				fprintf(stderr, PROGRAM ": waiting %d seconds to respawn...\n", RESPAWN);
-				sleep(RESPAWN);
-				goto reexec;
+		case 'j':
+			policy.jitter = strtod(optarg, &end);
+			if (*end || end == optarg || policy.jitter < 0 || policy.jitter > 1) {
+				fprintf(stderr, PROGRAM ": invalid jitter '%s' (should be between 0 and 1)\n", optarg);
+				exit(EXIT_IMPROPER);
 			}
+			break;
 
-			if (now.tv_sec < last.tv_sec + TOOFAST) {
-				fprintf(stderr, PROGRAM ": process dying too quickly; waiting %d seconds to respawn...\n", RESPAWN);
-				sleep(RESPAWN);
+		case 'r':
+			policy.limit = (int)strtol(optarg, &end, 10);
+			if (end == optarg || *end != '/' || policy.limit < 1) {
+				fprintf(stderr, PROGRAM ": invalid restart limit '%s' (should be N/SECONDS)\n", optarg);
+				exit(EXIT_IMPROPER);
 			}
-			goto reexec;
+			policy.window = ms("-r", end + 1);
+			break;
+
+		case 'e': codes("-e", optarg, policy.only); policy.filtered = 1; break;
+		case 'E': codes("-E", optarg, policy.never); break;
+		default:  usage(EXIT_IMPROPER);
+		}
+	}
+	argc -= optind; argv += optind;
+	if (argc < 1) usage(EXIT_IMPROPER);
+	if (policy.max < policy.backoff)
+		policy.max = policy.backoff;
+	if (probe.interval < 1)
+		probe.interval = 1;
+	if (probe.timeout < 0 || probe.timeout > probe.interval)
+		probe.timeout = probe.interval;
+	if (probe.grace < 0)
+		probe.grace = probe.interval * probe.failures;
+	my.argv = argv;
+	my.sock = -1;
+	my.pidfd = my.oldfd = -1;
+
+	if (policy.limit) {
+		my.restarts = calloc(policy.limit, sizeof(long));
+		if (!my.restarts) {
+			fprintf(stderr, PROGRAM ": out of memory\n");
+			exit(EXIT_RUNTIME);
+		}
+	}
+
+	if (fcntl(3, F_GETFD) >= 0) {
+		my.debug = fdopen(3, "w");
+	} else {
+		my.debug = fopen("/dev/null", "w");
+	}
+	if (my.debug)
+		setvbuf(my.debug, NULL, _IOLBF, 0);
+
+	if (!freopen("/dev/null", "r", stdin)) {
+		fprintf(stderr, PROGRAM ": failed to redirect /dev/null into stdin\n");
+		fclose(stdin);
+	}
+
+	my.null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (probe.kind == PROBE_EXEC && my.null < 0) {
+		fprintf(stderr, PROGRAM ": failed to open /dev/null: %s (error %d)\n", strerror(errno), errno);
+		exit(EXIT_RUNTIME);
+	}
+
+	/* everything (child exits, stop requests, forwarded
+	   signals, timers and probes) is handled from one event loop. */
+	my.mask = forward;
+	sigaddset(&my.mask, SIGCHLD);
+	sigaddset(&my.mask, SIGTERM);
+	sigaddset(&my.mask, SIGINT);
+	if (policy.rehup)
+		sigaddset(&my.mask, SIGHUP);
+
+	sfd         = rig_signalfd(&my.mask);
+	my.timer    = rig_timer(CLOCK_MONOTONIC);
+	my.deadline = rig_timer(CLOCK_MONOTONIC);
+	my.tick     = rig_timer(CLOCK_MONOTONIC);
+	my.expiry   = rig_timer(CLOCK_MONOTONIC);
+	if (sfd < 0 || my.timer < 0 || my.deadline < 0 || my.tick < 0 || my.expiry < 0
+	 || rig_watch(sfd,         EPOLLIN, signalled, NULL) != 0
+	 || rig_watch(my.timer,    EPOLLIN, backedoff, NULL) != 0
+	 || rig_watch(my.deadline, EPOLLIN, overdue,   NULL) != 0
+	 || rig_watch(my.tick,     EPOLLIN, ticked,    NULL) != 0
+	 || rig_watch(my.expiry,   EPOLLIN, timedout,  NULL) != 0) {
+		fprintf(stderr, PROGRAM ": failed to set up event handling: %s (error %d)\n", strerror(errno), errno);
+		exit(EXIT_RUNTIME);
+	}
+
+	if (probe.kind)
+		rig_arm(my.tick, probe.interval * 1000000LL, probe.interval * 1000000LL, 0);
+
+	srand((unsigned)(time(NULL) ^ getpid()));
+	start();
+
+	for (;;) {
+		if (rig_dispatch(-1) < 0) {
+			fprintf(stderr, PROGRAM ": epoll_wait() failed: %s (error %d)\n", strerror(errno), errno);
+			exit(EXIT_RUNTIME);
 		}
 	}
 
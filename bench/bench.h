@@ -0,0 +1,68 @@
+/*
+   bench.h - What all of the benchmarks (in bench/) share
+
+   Every benchmark prints its results to standard output as
+   JSON, one object per line, each looking something like:
+
+     {"bench":"logto","case":"256b","version":"1.0","lines":131072,...}
+
+   so that `make bench > results.json' can be kept around and
+   compared against the next release.  Anything else (progress,
+   and the tools' own chatter) goes to standard error.
+
+ */
+
+#ifndef RIG_BENCH_H
+#define RIG_BENCH_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+
+static inline double
+since(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+   Print one result.  `fmt` (and the rest of the args) make up
+   the rest of the fields, i.e. "\"entries\":%lu,\"ms\":%.3f".
+ */
+static inline void
+result(const char *bench, const char *name, const char *fmt, ...)
+{
+	va_list ap;
+
+	printf("{\"bench\":\"%s\",\"case\":\"%s\",\"version\":\"" VERSION "\",", bench, name);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("}\n");
+	fflush(stdout);
+}
+
+static inline int
+ascending(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+   The `q'th quantile (0 to 1) of `n` sorted values.
+ */
+static inline double
+quantile(const double *v, size_t n, double q)
+{
+	size_t i;
+
+	if (!n)
+		return 0;
+	i = (size_t)(q * n);
+	return v[i < n ? i : n - 1];
+}
+
+#endif
@@ -0,0 +1,139 @@
+/*
+   chain - Benchmark spawn latency of a typical tool chain
+
+   Times fork-to-reap of `always -E 0 runas U G locked LOCK true',
+   run three ways: as separate binaries, each exec'ing the next;
+   via the multi-call `rig' binary, where the chained tools run
+   in-process; and via `rig-static', if it has been built.  A
+   bare `true' is timed too, as the floor.
+
+   runas is left out of the chain unless we are root (it needs
+   to be, to clear supplementary groups).  Run from the top of
+   the source tree, after `make'.
+
+   USAGE: bench/chain [RUNS]
+
+ */
+
+#include "../rig.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/*
+   Run `argv` `runs` times, one after the other, and return
+   the average time (in seconds) from fork() to reaping it.
+ */
+static double
+spawn(char **argv, unsigned long runs)
+{
+	struct timespec start;
+	unsigned long n;
+	pid_t pid;
+	int rc;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (n = 0; n < runs; n++) {
+		pid = fork();
+		if (pid < 0)
+			return -1;
+		if (pid == 0) {
+			/* always is chatty, and we're only counting */
+			dup2(open("/dev/null", O_WRONLY), 2);
+			execv(argv[0], argv);
+			exit(EXIT_IN_CHILD);
+		}
+		if (waitpid(pid, &rc, 0) != pid || rc != 0) {
+			fprintf(stderr, "chain: '%s' failed (status %d)\n", argv[0], rc);
+			return -1;
+		}
+	}
+	return since(&start) / runs;
+}
+
+/*
+   Fill in `argv` with the chain, starting with `rig` (if it's
+   not NULL), and with `prefix` in front of each tool name.
+ */
+static void
+chain(char **argv, const char *rig, const char *prefix, int root, char *ids, char *lock, char *truth)
+{
+	static char names[3][64];
+	int i;
+
+	i = 0;
+	if (rig) argv[i++] = (char *)rig;
+	snprintf(names[0], sizeof(names[0]), "%salways", rig ? "" : prefix);
+	snprintf(names[1], sizeof(names[1]), "%srunas",  rig ? "" : prefix);
+	snprintf(names[2], sizeof(names[2]), "%slocked", rig ? "" : prefix);
+
+	argv[i++] = names[0];
+	argv[i++] = "-E";
+	argv[i++] = "0";
+	if (root) {
+		argv[i++] = names[1];
+		argv[i++] = ids;
+		argv[i++] = ids;
+	}
+	argv[i++] = names[2];
+	argv[i++] = lock;
+	argv[i++] = truth;
+	argv[i++] = NULL;
+}
+
+int main(int argc, char **argv)
+{
+	char lock[] = "/tmp/chain-lock.XXXXXX";
+	char ids[] = "0", truth[] = "/bin/true";
+	char *args[16];
+	unsigned long runs;
+	double floor, t;
+	int fd, root;
+
+	runs = argc > 1 ? strtoul(argv[1], NULL, 10) : 500;
+	root = geteuid() == 0;
+
+	fd = mkstemp(lock);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", lock, strerror(errno));
+		return EXIT_RUNTIME;
+	}
+	close(fd);
+
+	args[0] = truth;
+	args[1] = NULL;
+	floor = spawn(args, runs);
+	if (floor < 0) return EXIT_RUNTIME;
+	result("chain", "true", "\"runs\":%lu,\"us\":%.1f", runs, floor * 1e6);
+
+	chain(args, NULL, "./", root, ids, lock, truth);
+	t = spawn(args, runs);
+	if (t < 0) return EXIT_RUNTIME;
+	result("chain", "separate", "\"runs\":%lu,\"runas\":%s,\"us\":%.1f,\"us_over_true\":%.1f",
+		runs, root ? "true" : "false", t * 1e6, (t - floor) * 1e6);
+
+	chain(args, "./rig", NULL, root, ids, lock, truth);
+	t = spawn(args, runs);
+	if (t < 0) return EXIT_RUNTIME;
+	result("chain", "rig", "\"runs\":%lu,\"runas\":%s,\"us\":%.1f,\"us_over_true\":%.1f",
+		runs, root ? "true" : "false", t * 1e6, (t - floor) * 1e6);
+
+	if (access("./rig-static", X_OK) == 0) {
+		chain(args, "./rig-static", NULL, root, ids, lock, truth);
+		t = spawn(args, runs);
+		if (t < 0) return EXIT_RUNTIME;
+		result("chain", "rig-static", "\"runs\":%lu,\"runas\":%s,\"us\":%.1f,\"us_over_true\":%.1f",
+			runs, root ? "true" : "false", t * 1e6, (t - floor) * 1e6);
+	}
+
+	unlink(lock);
+	return 0;
+}
@@ -0,0 +1,111 @@
+/*
+   every-drift - Benchmark how closely every sticks to its schedule
+
+   Runs `./every 20ms' for 250 ticks (five seconds), with this
+   very program as the command (`every-drift stamp'), which
+   just writes the time it got started back to us.  Each run
+   should start a whole number of intervals after the first
+   one; how far off it is, is its lateness.  The lateness of
+   the last one is the drift (every works out ticks from when
+   it started, so this shouldn't grow), and any whole intervals
+   with no run in them were missed.  Run from the top of the
+   source tree, after `make'.
+
+   USAGE: bench/every-drift [TICKS [MILLISECONDS]]
+
+ */
+
+#include "../rig.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+static long long
+stamp(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long ticks, ms, n, idx;
+	long long t, *at, interval;
+	double *late, sum, drift;
+	char every[32], name[32];
+	int fds[2], rc;
+	pid_t pid;
+
+	if (argc == 2 && eq(argv[1], "stamp")) {
+		t = stamp();
+		return write(1, &t, sizeof(t)) == sizeof(t) ? EXIT_OK : EXIT_RUNTIME;
+	}
+
+	ticks = argc > 1 ? strtoul(argv[1], NULL, 10) : 250;
+	ms    = argc > 2 ? strtoul(argv[2], NULL, 10) : 20;
+	if (ticks < 2 || ms < 1) {
+		fprintf(stderr, "USAGE: bench/every-drift [TICKS [MILLISECONDS]]\n");
+		return EXIT_IMPROPER;
+	}
+	interval = ms * 1000000LL;
+
+	at   = calloc(ticks, sizeof(*at));
+	late = calloc(ticks, sizeof(*late));
+	if (!at || !late || pipe(fds) != 0) {
+		fprintf(stderr, "every-drift: %s\n", strerror(errno));
+		return EXIT_RUNTIME;
+	}
+
+	snprintf(every, sizeof(every), "%lums", ms);
+	pid = fork();
+	if (pid < 0)
+		return EXIT_RUNTIME;
+	if (pid == 0) {
+		dup2(fds[1], 1);
+		close(fds[0]);
+		close(fds[1]);
+		execl("./every", "every", every, argv[0], "stamp", (char *)NULL);
+		exit(EXIT_IN_CHILD);
+	}
+	close(fds[1]);
+
+	for (n = 0; n < ticks; n++)
+		if (read(fds[0], &at[n], sizeof(at[n])) != sizeof(at[n]))
+			break;
+	kill(pid, SIGTERM);
+	waitpid(pid, &rc, 0);
+	if (n < ticks) {
+		fprintf(stderr, "every-drift: only got %lu of %lu ticks (every %s)\n", n, ticks, rig_status(rc));
+		return EXIT_RUNTIME;
+	}
+
+	for (n = 0; n < ticks; n++) {
+		/* the nearest tick; runs are never early, but
+		   the first one could have been a bit late */
+		idx = (unsigned long)((at[n] - at[0] + interval / 2) / interval);
+		late[n] = (at[n] - at[0] - (long long)idx * interval) / 1e3;
+	}
+	drift = late[ticks - 1];
+	for (sum = 0, n = 0; n < ticks; n++) {
+		if (late[n] < 0)
+			late[n] = -late[n];
+		sum += late[n];
+	}
+	qsort(late, ticks, sizeof(double), ascending);
+
+	snprintf(name, sizeof(name), "%lums", ms);
+	result("every-drift", name,
+		"\"ticks\":%lu,\"interval_ms\":%lu,\"late_mean_us\":%.1f,\"late_p50_us\":%.1f,"
+		"\"late_p99_us\":%.1f,\"late_max_us\":%.1f,\"drift_us\":%.1f,\"missed\":%lu",
+		ticks, ms, sum / ticks, quantile(late, ticks, 0.5), quantile(late, ticks, 0.99),
+		late[ticks - 1], drift, idx + 1 - ticks);
+	return EXIT_OK;
+}
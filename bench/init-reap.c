@@ -0,0 +1,153 @@
+/*
+   init-reap - Benchmark init's child table, with 10k entries
+
+   Builds a 10,000-entry inittab, and then measures how long
+   init takes to parse it, to reload it (diffing against the
+   running configuration), and to handle a child exiting (pid
+   lookup + respawn bookkeeping; no actual processes involved).
+
+   Then, for real: an orphan storm.  One of the entries forks
+   1,000 children into its session, and exits; they all get
+   handed to us (as a subreaper), and are let go all at once.
+   We time how long it takes init's reaper to reap them all,
+   and check that they were all traced back to their entry.
+
+   USAGE: bench/init-reap [ENTRIES [EXITS [ORPHANS]]]
+
+ */
+
+#define main init_main
+#include "../init.c"
+#undef main
+
+#include "bench.h"
+
+/*
+   Have child 0 set off an orphan storm; returns how long it
+   took (in seconds) to reap all of the orphans, or -1.
+ */
+static double
+storm(unsigned long orphans)
+{
+	struct timespec start;
+	unsigned long n;
+	int go[2], ready[2];
+	pid_t kid;
+	char c;
+
+	if (prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) != 0 || pipe(go) != 0 || pipe(ready) != 0)
+		return -1;
+
+	kid = fork();
+	if (kid < 0)
+		return -1;
+	if (kid == 0) {
+		setsid();
+		close(go[1]);
+		close(ready[0]);
+		for (n = 0; n < orphans; n++) {
+			if (fork() == 0) {
+				/* wait for everyone else */
+				if (read(go[0], &c, 1) < 0)
+					_exit(1);
+				_exit(0);
+			}
+		}
+		if (write(ready[1], "", 1) < 0)
+			_exit(1);
+		_exit(0);
+	}
+	close(go[0]);
+	close(ready[1]);
+
+	/* it's entry 0 now */
+	forget(CONFIG, CONFIG->child[0].pid);
+	CONFIG->child[0].pid = kid;
+	track(CONFIG, 0);
+	if (adopt(CONFIG, kid, 0) != 0)
+		return -1;
+
+	if (read(ready[0], &c, 1) != 1)
+		return -1;
+	while (CONFIG->child[0].pid == kid)
+		reaper();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	close(go[1]);
+	while (reaper())
+		;
+	return since(&start);
+}
+
+int main(int argc, char **argv)
+{
+	char path[] = "/tmp/init-reap.XXXXXX";
+	struct timespec start;
+	unsigned long entries, exits, orphans, n;
+	double t;
+	pid_t pid;
+	long i;
+	FILE *f;
+	int fd;
+
+	entries = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+	exits   = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+	orphans = argc > 3 ? strtoul(argv[3], NULL, 10) : 1000;
+
+	fd = mkstemp(path);
+	if (fd < 0 || !(f = fdopen(fd, "w"))) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return EXIT_RUNTIME;
+	}
+	for (n = 0; n < entries; n++)
+		fprintf(f, "/usr/lib/workers/worker-%05lu\n", n);
+	fclose(f);
+
+	/* configure() is chatty on stderr; mute it */
+	if (!freopen("/dev/null", "w", stderr))
+		return EXIT_RUNTIME;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	CONFIG = configure(path);
+	if (!CONFIG)
+		return EXIT_RUNTIME;
+	result("init-reap", "parse", "\"entries\":%lu,\"ms\":%.3f", entries, since(&start) * 1e3);
+
+	/* made-up pids start past the kernel's PID_MAX_LIMIT,
+	   so they can't collide with the storm's real ones */
+	pid = 4194304;
+	for (n = 0; n < CONFIG->n; n++) {
+		CONFIG->child[n].pid = pid++;
+		track(CONFIG, n);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (reconfigure(path) != 0)
+		return EXIT_RUNTIME;
+	result("init-reap", "reload", "\"entries\":%lu,\"ms\":%.3f", entries, since(&start) * 1e3);
+
+	/* exits arrive in a scattered order; respawns get
+	   the next pid up, like the kernel hands them out. */
+	srand(42);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (n = 0; n < exits; n++) {
+		i = forget(CONFIG, CONFIG->child[rand() % CONFIG->n].pid);
+		if (i < 0)
+			return EXIT_RUNTIME;
+		CONFIG->child[i].pid = pid++;
+		track(CONFIG, i);
+	}
+	result("init-reap", "exits", "\"entries\":%lu,\"exits\":%lu,\"ns_per_exit\":%.1f",
+		entries, exits, since(&start) * 1e9 / exits);
+
+	unlink(path);
+
+	if (orphans) {
+		t = storm(orphans);
+		if (t < 0)
+			return EXIT_RUNTIME;
+		result("init-reap", "orphan-storm", "\"entries\":%lu,\"orphans\":%lu,\"attributed\":%lu,\"ms\":%.3f,\"us_per_orphan\":%.2f",
+			entries, orphans, CONFIG->stats[0].orphans, t * 1e3, t * 1e6 / orphans);
+	}
+	return EXIT_OK;
+}
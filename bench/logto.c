@@ -0,0 +1,135 @@
+/*
+   logto - Benchmark logto throughput, at various line sizes
+
+   Pipes the same amount of log data (16MB, by default) through
+   ./logto into a scratch file, as 16-, 64-, 256-, 1024- and
+   4096-byte lines, and times it, from fork() until logto has
+   exited.  The file's size is checked afterwards: every line
+   should be in it, with its 16-byte timestamp.  If any bytes
+   went missing (or extra ones turned up), the result is still
+   printed, but we exit non-zero.  Run from the top of the
+   source tree, after `make'.
+
+   USAGE: bench/logto [MEGABYTES]
+
+ */
+
+#include "../rig.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define CHUNK 65536
+
+static const size_t SIZES[] = { 16, 64, 256, 1024, 4096 };
+
+/*
+   Send `lines` lines of `size` bytes (newline included) through
+   logto, into `file`.  Returns how long it took, or -1.
+ */
+static double
+run(const char *file, size_t size, unsigned long lines)
+{
+	struct timespec start;
+	static char buf[CHUNK];
+	unsigned long sent, per;
+	char *argv[3];
+	size_t i;
+	pid_t pid;
+	int fds[2], rc;
+
+	/* a chunk's worth of whole lines */
+	per = CHUNK / size;
+	for (i = 0; i < per * size; i++)
+		buf[i] = (i + 1) % size == 0 ? '\n' : 'a' + i % 26;
+
+	if (pipe(fds) != 0)
+		return -1;
+
+	argv[0] = "./logto";
+	argv[1] = (char *)file;
+	argv[2] = NULL;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid = fork();
+	if (pid < 0)
+		return -1;
+	if (pid == 0) {
+		dup2(fds[0], 0);
+		close(fds[0]);
+		close(fds[1]);
+		execv(argv[0], argv);
+		exit(EXIT_IN_CHILD);
+	}
+	close(fds[0]);
+
+	for (sent = 0; sent < lines; sent += per) {
+		if (lines - sent < per)
+			per = lines - sent;
+		if (write(fds[1], buf, per * size) != (ssize_t)(per * size)) {
+			fprintf(stderr, "logto: short write: %s\n", strerror(errno));
+			break;
+		}
+	}
+	close(fds[1]);
+
+	if (waitpid(pid, &rc, 0) != pid || rc != 0) {
+		fprintf(stderr, "logto: ./logto %s\n", rig_status(rc));
+		return -1;
+	}
+	return since(&start);
+}
+
+int main(int argc, char **argv)
+{
+	char file[] = "/tmp/bench-logto.XXXXXX", name[32];
+	unsigned long mb, lines;
+	unsigned long long expected;
+	struct stat st;
+	double t;
+	size_t i;
+	int fd, rc;
+
+	mb = argc > 1 ? strtoul(argv[1], NULL, 10) : 16;
+	signal(SIGPIPE, SIG_IGN);
+	rc = EXIT_OK;
+
+	for (i = 0; i < sizeof(SIZES) / sizeof(SIZES[0]); i++) {
+		fd = mkstemp(file);
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s\n", file, strerror(errno));
+			return EXIT_RUNTIME;
+		}
+		close(fd);
+
+		lines = mb * 1024 * 1024 / SIZES[i];
+		t = run(file, SIZES[i], lines);
+		if (t < 0 || stat(file, &st) != 0)
+			return EXIT_RUNTIME;
+		unlink(file);
+		strcpy(file + strlen(file) - 6, "XXXXXX");
+
+		expected = (unsigned long long)lines * (SIZES[i] + 16);
+		snprintf(name, sizeof(name), "%lub", (unsigned long)SIZES[i]);
+		result("logto", name,
+			"\"line_bytes\":%lu,\"lines\":%lu,\"seconds\":%.4f,\"lines_per_sec\":%.0f,"
+			"\"mb_per_sec\":%.2f,\"bytes_out\":%lld,\"bytes_expected\":%llu",
+			(unsigned long)SIZES[i], lines, t, lines / t, mb / t,
+			(long long)st.st_size, expected);
+		if ((unsigned long long)st.st_size != expected) {
+			fprintf(stderr, "logto: wrote %lld bytes of %llu, with %lu-byte lines\n",
+				(long long)st.st_size, expected, (unsigned long)SIZES[i]);
+			rc = EXIT_RUNTIME;
+		}
+	}
+	return rc;
+}
@@ -0,0 +1,122 @@
+/*
+   supervise-scan - Benchmark supervise's directory scans
+
+   For 10, 1,000 and 10,000 services, measures how long it takes
+   supervise to start them all from a cold start, to rescan the
+   directory when they are all running (which it does every
+   couple of seconds, forever), and to notice and restart 1% of
+   them (at least one) after they exit.  Nothing is actually
+   spawned; rig_spawn() is swapped out for a stand-in that just
+   hands out made-up pids, so that the numbers are supervise's
+   bookkeeping, and not fork() and exec().
+
+   Restarts happen on the next scan, so a real restart also
+   waits for that, up to RESCAN seconds (reported alongside).
+
+   USAGE: bench/supervise-scan [SCANS]
+
+ */
+
+#define main supervise_main
+#define rig_spawn fake_spawn
+#include "../supervise.c"
+#undef rig_spawn
+#undef main
+
+#include "bench.h"
+
+#include <fcntl.h>
+
+static const unsigned long COUNTS[] = { 10, 1000, 10000 };
+
+static pid_t NEXTPID;
+static unsigned long SPAWNED;
+
+pid_t
+fake_spawn(const char *program, char **argv, const sigset_t *mask, const int fds[3])
+{
+	(void)program; (void)argv; (void)mask; (void)fds;
+	SPAWNED++;
+	return NEXTPID++;
+}
+
+int main(int argc, char **argv)
+{
+	char dir[] = "/tmp/bench-supervise.XXXXXX", name[64];
+	struct timespec start;
+	unsigned long scans, n, k, i;
+	double cold, scan, restart;
+	size_t c;
+	int fd;
+
+	scans = argc > 1 ? strtoul(argv[1], NULL, 10) : 20;
+	if (!scans) scans = 1;
+
+	for (c = 0; c < sizeof(COUNTS) / sizeof(COUNTS[0]); c++) {
+		n = COUNTS[c];
+		if (!mkdtemp(dir) || chdir(dir) != 0) {
+			fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+			return EXIT_RUNTIME;
+		}
+		for (i = 0; i < n; i++) {
+			snprintf(name, sizeof(name), "service-%05lu", i);
+			fd = open(name, O_WRONLY | O_CREAT | O_EXCL, 0755);
+			if (fd < 0) {
+				fprintf(stderr, "%s/%s: %s\n", dir, name, strerror(errno));
+				return EXIT_RUNTIME;
+			}
+			close(fd);
+		}
+
+		free(services);
+		free(byinode);
+		free(bypid);
+		services = NULL;
+		byinode = NULL;
+		bypid = NULL;
+		nservices = capacity = 0;
+		NEXTPID = 100000;
+		SPAWNED = 0;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		runall();
+		cold = since(&start);
+		if (SPAWNED != n) {
+			fprintf(stderr, "supervise-scan: started %lu of %lu services\n", SPAWNED, n);
+			return EXIT_RUNTIME;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < scans; i++)
+			runall();
+		scan = since(&start) / scans;
+
+		/* take out every 100th, as if they'd all exited */
+		k = n / 100 ? n / 100 : 1;
+		SPAWNED = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < k; i++)
+			reaped(services[i * (n / k)].pid);
+		runall();
+		restart = since(&start);
+		if (SPAWNED != k) {
+			fprintf(stderr, "supervise-scan: restarted %lu of %lu services\n", SPAWNED, k);
+			return EXIT_RUNTIME;
+		}
+
+		snprintf(name, sizeof(name), "%lu", n);
+		result("supervise-scan", name,
+			"\"services\":%lu,\"cold_start_ms\":%.3f,\"scan_ms\":%.3f,"
+			"\"restarted\":%lu,\"restart_ms\":%.3f,\"rescan_every_s\":%d",
+			n, cold * 1e3, scan * 1e3, k, restart * 1e3, RESCAN);
+
+		for (i = 0; i < n; i++) {
+			snprintf(name, sizeof(name), "service-%05lu", i);
+			unlink(name);
+		}
+		if (chdir("/") != 0 || rmdir(dir) != 0)
+			fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+		strcpy(dir + strlen(dir) - 6, "XXXXXX");
+	}
+	return EXIT_OK;
+}
@@ -23,34 +23,192 @@
 
    every - Run a command on a periodic schedule
 
-   USAGE: every N path/to/command args...
+   USAGE: every [OPTIONS] N path/to/command args...
+          every [OPTIONS] -c 'MIN HOUR DAY MONTH WEEKDAY' path/to/command args...
+          every [OPTIONS] -f path/to/schedule
           every -v
 
-   N must be in seconds, without a unit.  Only values between 1 and 86400
+   N is an interval, with an optional unit: ms (milliseconds), s (seconds;
+   the default), m (minutes) or h (hours).  Only values between 1ms and 24h
    (1 day) are allowed.  Values outside of that range will cause `every'
    to exit non-zero.
 
+   Runs are scheduled on fixed ticks, N apart, counting from when `every'
+   started; a run that takes a while doesn't push the rest of the schedule
+   back.
+
+   With -c, runs are scheduled by the (local) wall clock instead, per a
+   crontab(5)-style expression: five fields, each either `*' or a comma-
+   separated list of values (`5'), ranges (`1-5') and steps (`*' + `/15',
+   or `0-30/10').  Weekdays run from 0 (Sunday) to 7 (Sunday, again).  As
+   with cron, if both DAY and WEEKDAY are restricted, either will do.
+
+   If the command is still running when the next tick comes around, -o
+   decides what happens:
+
+     skip    Don't run it this time.
+     queue   Run it as soon as the current run finishes, but don't
+             let more than one run pile up.  This is the default.
+     K       Let up to K runs go at once (any more are skipped).
+
+   OPTIONS are -o (above), -s and -j (below), -w and -S (further below).
+
+   Ticks that go by without us noticing at all (i.e. while suspended)
+   are counted, and reported, rather than being made up for.
+
+   So that a fleet of hosts, all booted at once, don't all run their
+   jobs in lock-step, ticks can be spread out:
+
+     -s      Splay.  Line ticks up with the wall clock (multiples of N
+             since the epoch), and then shift them by a fixed amount, no
+             more than N, worked out from /etc/machine-id (or, failing
+             that, the hostname).  Each host gets its own offset, and it
+             stays the same from one run of `every' to the next.  There
+             is no run at startup; the first run is on the first tick.
+             For -c schedules, the offset is less than a minute.
+
+     -j J    Jitter.  Put each run off by a random amount, up to J (an
+             interval, like N).  This doesn't accumulate; each run is
+             still relative to its own tick.
+
+   With -f, a single `every' process runs a whole schedule of jobs,
+   one per line of the given file, each with its own timing, overlap
+   policy and tally of failed runs:
+
+       # N or cron expression   options...      command...
+       5m                                       /usr/bin/sweep /tmp
+       250ms                    overlap=skip    poll-the-thing
+       cron 0 3 * * *           splay jitter=5m nightly --full
+
+   Options are overlap=POLICY, jitter=J, warn=F, and splay; anything
+   given on the command-line (-o, -j, -w and -s) sets the default for
+   every line.
+   The rest of the line is the command, which is run via /bin/sh -c.
+   Blank lines, and lines starting with `#', are ignored.  Splayed jobs
+   in a schedule file take their command into account, as well as the
+   host, so they don't all fire at once.
+
+   However many jobs there are, `every' keeps a single timer, for the
+   next one due, so it only wakes up when something needs running.
+
+   Each run is timed, and its CPU time and peak memory usage noted.  The
+   wall-clock time of the last 128 runs of each job give its median, p90
+   and p99 run time, which are logged on fd 3 after each run.
+
+     -w F    Warn (on stderr) when a job's p99 run time gets to be more
+             than F (a fraction, like 0.8) of its interval -- before it
+             starts overlapping with itself, ideally.
+
+     -S FILE Keep FILE up to date with all of the above (and run, fail,
+             skip and miss counts) for each job, in the Prometheus text
+             exposition format.  FILE is replaced (via rename) each time,
+             so readers never see half of it.
+
  */
 
+#define _DEFAULT_SOURCE /* for wait4() */
 #include "rig.h"
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
+#include <signal.h>
 #include <time.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
 #define PROGRAM "every"
 
+#define NSEC 1000000000LL
+
+/* how many runs to keep timings for, per job */
+#define RING 128
+
+/* overlap policies */
+#define SKIP  0
+#define QUEUE 1
+#define ALLOW 2
+
+/*
+   `struct cron` is a parsed crontab-style schedule, with one
+   bit set for each value that each field matches.
+ */
+struct cron {
+	uint64_t minute;          /* bits 0 - 59                 */
+	uint64_t hour;            /* bits 0 - 23                 */
+	uint64_t mday;            /* bits 1 - 31                 */
+	uint64_t month;           /* bits 1 - 12                 */
+	uint64_t wday;            /* bits 0 - 6 (Sunday = 0)     */
+	int any_mday, any_wday;   /* were they `*'?              */
+};
+
+/*
+   `struct job` is a command, and its schedule: it runs on
+   every tick, where tick k is at anchor + k * interval, or
+   (for -c jobs) whenever the cron schedule says.
+ */
+struct job {
+	char **argv;              /* what to run                 */
+	const char *name;         /* ... and what to call it     */
+	int line;                 /* where it came from (-f)     */
+	long long interval;       /* ns between ticks            */
+	long long anchor;         /* when tick 0 was (ns)        */
+	unsigned long long tick;  /* the next tick to run on     */
+
+	int calendar;             /* is this a -c job?           */
+	struct cron cron;         /* ... on this schedule        */
+	time_t at;                /* ... next due at this time   */
+
+	int splayed;              /* -s (or `splay')?            */
+	long long splay;          /* fixed offset (ns)           */
+	long long jitter;         /* max random offset (ns)      */
+	long long fuzz;           /* ... for the next tick (ns)  */
+
+	long long deadline;       /* when it's next due (ns)     */
+	size_t pos;               /* where it is in the heap     */
+
+	int overlap;              /* SKIP, QUEUE or ALLOW        */
+	int limit;                /* max concurrent runs         */
+	int queued;               /* is a run waiting? (QUEUE)   */
+	int running;              /* how many are running now    */
+
+	unsigned long runs;       /* how many times we've run it */
+	unsigned long skipped;    /* ticks skipped for overlap   */
+	unsigned long missed;     /* ticks that we slept through */
+	unsigned long failed;     /* runs that didn't exit 0     */
+
+	double warn;              /* -w fraction (0 = don't)     */
+	int slow;                 /* ... and are we over it?     */
+
+	double times[RING];       /* run times (s), a ring       */
+	unsigned long timed;      /* runs that we've timed       */
+	double wall;              /* total run time (s)          */
+	double cpu;               /* total CPU time (s)          */
+	long rss;                 /* biggest max RSS (KiB)       */
+	double p50, p90, p99;     /* over the last RING runs     */
+};
+
+static FILE *debug;
+static struct job *JOBS;  /* everything we're running */
+static size_t NJOBS;
+static const char *STATS; /* -S */
+static int DIRTY;         /* ... needs rewriting */
+
 static void
 oops_improper(const char *v)
 {
-	if (v) fprintf(stderr, PROGRAM ": invalid value for N '%s' (must be between 1-86400, inclusive)\n", v);
-	else   fprintf(stderr, PROGRAM ": invalid value for N (must be between 1-86400, inclusive)\n");
+	if (v) fprintf(stderr, PROGRAM ": invalid value for N '%s' (must be between 1ms and 24h, inclusive)\n", v);
+	else   fprintf(stderr, PROGRAM ": invalid value for N (must be between 1ms and 24h, inclusive)\n");
 	exit(EXIT_IMPROPER);
 }
 
@@ -61,109 +219,1205 @@ oops_runtime(const char *s)
 	exit(EXIT_RUNTIME);
 }
 
-int main(int argc, char **argv)
+static void
+usage(void)
 {
-	pid_t pid;
-	int n, rc, use_clock;
-	char *p;
-	struct timespec start, end, nap;
-	FILE *debug;
-
-	if (argc > 1 && argv[1][0] == '-') {
-		if (eq(argv[1], "-v")) show_version(PROGRAM);
-		fprintf(stderr, "USAGE: every N path/to/command args...\n");
-		exit(EXIT_IMPROPER);
+	fprintf(stderr, "USAGE: every [OPTIONS] N path/to/command args...\n"
+	                "       every [OPTIONS] -c 'MIN HOUR DAY MONTH WEEKDAY' path/to/command args...\n"
+	                "       every [OPTIONS] -f path/to/schedule\n"
+	                "\n"
+	                "OPTIONS: -o skip|queue|K   what to do if the last run is still going\n"
+	                "         -s                splay ticks per host\n"
+	                "         -j J              jitter each run by up to J\n"
+	                "         -w F              warn if p99 run time is over F of the interval\n"
+	                "         -S FILE           write per-job stats to FILE\n"
+	                "\n"
+	                "N (and J) can have a unit: ms, s (the default), m or h.\n"
+	                "Valid values are between 1ms and 24h, inclusive.\n");
+	exit(EXIT_IMPROPER);
+}
+
+/*
+   Parse an interval, like `250ms', `5s', `5', `2m' or `1h',
+   into nanoseconds.  Returns -1 if it is malformed, or out
+   of range (1ms - 24h).
+ */
+static long long
+interval(const char *v)
+{
+	long long n, unit;
+	const char *p;
+
+	p = v;
+	if (*p == '+') p++;
+	if (!isdigit((unsigned char)*p))
+		return -1;
+
+	for (n = 0; isdigit((unsigned char)*p); p++) {
+		n = n * 10 + (*p - '0');
+		if (n > 86400000) return -1;
 	}
-	if (argc < 3) {
-		fprintf(stderr, "USAGE: every N path/to/command args...\n"
-		                "\n"
-		                "N must be in seconds, without a unit.\n"
-		                "Valid values are between 1 and 86400, inclusive.\n");
+
+	if      (!*p || eq(p, "s")) unit = NSEC;
+	else if (eq(p, "ms"))       unit = NSEC / 1000;
+	else if (eq(p, "m"))        unit = NSEC * 60;
+	else if (eq(p, "h"))        unit = NSEC * 3600;
+	else return -1;
+
+	if (n > NSEC * 86400 / unit)
+		return -1;
+	n *= unit;
+	if (n < NSEC / 1000)
+		return -1;
+	return n;
+}
+
+/*
+   Parse one field of a cron expression (from `*s`, up to the
+   next whitespace) into `bits`, advancing `*s` past it.
+   Returns 1 if the field was just `*', 0 if it was anything
+   else, and -1 if it was bad.
+ */
+static int
+field(const char **s, int lo, int hi, uint64_t *bits)
+{
+	const char *p;
+	char *end;
+	long a, b, step;
+	int star;
+
+	p = *s;
+	while (isspace((unsigned char)*p)) p++;
+	if (!*p)
+		return -1;
+
+	*bits = 0;
+	star = (p[0] == '*' && (!p[1] || isspace((unsigned char)p[1])));
+	for (;;) {
+		if (*p == '*') {
+			a = lo; b = hi; p++;
+		} else {
+			a = b = strtol(p, &end, 10);
+			if (end == p) return -1;
+			p = end;
+			if (*p == '-') {
+				b = strtol(p + 1, &end, 10);
+				if (end == p + 1) return -1;
+				p = end;
+			}
+		}
+		step = 1;
+		if (*p == '/') {
+			step = strtol(p + 1, &end, 10);
+			if (end == p + 1 || step < 1) return -1;
+			p = end;
+		}
+		if (a < lo || b > hi || a > b)
+			return -1;
+		for (; a <= b; a += step)
+			*bits |= 1ULL << a;
+
+		if (*p != ',')
+			break;
+		p++;
+	}
+	if (*p && !isspace((unsigned char)*p))
+		return -1;
+
+	*s = p;
+	return star;
+}
+
+static time_t cron_next(const struct cron *c, time_t after);
+
+/*
+   Parse the five fields of a cron expression from `*s` into
+   `c`, advancing `*s` past them.  Returns 0 on success, or
+   -1 if the expression is bad.
+ */
+static int
+cronspec(struct cron *c, const char **s)
+{
+	int rc;
+
+	if (field(s, 0, 59, &c->minute) < 0
+	 || field(s, 0, 23, &c->hour) < 0
+	 || (c->any_mday = field(s, 1, 31, &c->mday)) < 0
+	 || field(s, 1, 12, &c->month) < 0
+	 || (rc = field(s, 0, 7, &c->wday)) < 0)
+		return -1;
+
+	c->any_wday = rc;
+	if (c->wday & (1ULL << 7))
+		c->wday |= 1; /* 7 is Sunday, too */
+	return 0;
+}
+
+static void
+crontab(struct job *job, const char *v)
+{
+	const char *p;
+
+	p = v;
+	if (cronspec(&job->cron, &p) != 0)
+		goto bad;
+	while (isspace((unsigned char)*p)) p++;
+	if (*p)
+		goto bad;
+
+	job->calendar = 1;
+	if (cron_next(&job->cron, time(NULL)) == (time_t)-1) {
+		fprintf(stderr, PROGRAM ": cron expression '%s' never matches anything\n", v);
 		exit(EXIT_IMPROPER);
 	}
+	return;
 
-	if (fcntl(3, F_GETFD) >= 0) {
-		debug = fdopen(3, "w");
-	} else {
-		debug = fopen("/dev/null", "w");
+bad:
+	fprintf(stderr, PROGRAM ": invalid cron expression '%s'\n", v);
+	exit(EXIT_IMPROPER);
+}
+
+/*
+   Find the lowest bit set in `bits` at or above `from`, and at
+   or below `to`; -1 if there isn't one.
+ */
+static int
+nextbit(uint64_t bits, int from, int to)
+{
+	for (; from <= to; from++)
+		if (bits & (1ULL << from))
+			return from;
+	return -1;
+}
+
+/*
+   Work out when (after `after`) a cron schedule next fires.
+
+   Rather than trying each minute in turn, this skips ahead a
+   field at a time: to the next matching month, then day, then
+   hour, then minute, starting over at the top whenever one of
+   those rolls over into the next larger unit.  mktime() takes
+   care of month lengths, leap years and DST.
+
+   Returns (time_t)-1 if nothing matches in the next few years
+   (i.e. for "0 0 31 2 *").
+ */
+static time_t
+cron_next(const struct cron *c, time_t after)
+{
+	struct tm tm;
+	time_t t;
+	int i, v;
+
+	if (!localtime_r(&after, &tm))
+		return (time_t)-1;
+	tm.tm_sec = 0;
+	tm.tm_min++;
+
+	for (i = 0; i < 4096; i++) {
+		tm.tm_isdst = -1;
+		t = mktime(&tm);
+		if (t == (time_t)-1)
+			return t;
+
+		if (!(c->month & (1ULL << (tm.tm_mon + 1)))) {
+			tm.tm_mon++; tm.tm_mday = 1; tm.tm_hour = 0; tm.tm_min = 0;
+			continue;
+		}
+
+		v = (c->any_mday || c->any_wday)
+		  ? (c->mday & (1ULL << tm.tm_mday)) && (c->wday & (1ULL << tm.tm_wday))
+		  : (c->mday & (1ULL << tm.tm_mday)) || (c->wday & (1ULL << tm.tm_wday));
+		if (!v) {
+			tm.tm_mday++; tm.tm_hour = 0; tm.tm_min = 0;
+			continue;
+		}
+
+		v = nextbit(c->hour, tm.tm_hour, 23);
+		if (v < 0) {
+			tm.tm_mday++; tm.tm_hour = 0; tm.tm_min = 0;
+			continue;
+		}
+		if (v != tm.tm_hour) {
+			tm.tm_hour = v; tm.tm_min = 0;
+			continue;
+		}
+
+		v = nextbit(c->minute, tm.tm_min, 59);
+		if (v < 0) {
+			tm.tm_hour++; tm.tm_min = 0;
+			continue;
+		}
+		if (v != tm.tm_min) {
+			tm.tm_min = v;
+			continue;
+		}
+
+		return t;
 	}
+	return (time_t)-1;
+}
+
+/*
+   Ticks are timed on CLOCK_BOOTTIME, not CLOCK_MONOTONIC (i.e.
+   rig_now()), because it keeps going while we're suspended, so
+   that ticks slept through show up as missed when we wake up.
+ */
+static long long
+now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_BOOTTIME, &ts) != 0)
+		oops_runtime("failed to get the current time");
+	return ts.tv_sec * NSEC + ts.tv_nsec;
+}
+
+static long long
+wallclock(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_REALTIME, &ts) != 0)
+		oops_runtime("failed to get the current time");
+	return ts.tv_sec * NSEC + ts.tv_nsec;
+}
+
+/*
+   FNV-1a, over `n` bytes of `buf` (skipping whitespace), on
+   top of `h`.  Start with h = FNV.
+ */
+#define FNV 14695981039346656037ULL
+static uint64_t
+fnv(uint64_t h, const char *buf, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (isspace((unsigned char)buf[i]))
+			continue;
+		h ^= (unsigned char)buf[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/*
+   Stir up a hash, so that the low bits are worth using.
+ */
+static uint64_t
+mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/*
+   Hash something that identifies this host (the machine-id if
+   there is one, the hostname if not), so that each host gets
+   its own splay, and keeps it across restarts.
+ */
+static uint64_t
+host(void)
+{
+	char buf[256];
+	ssize_t n;
+	int fd;
 
 	n = 0;
-	p = argv[1];
-	if (*p == '+') p++;
-	for (; *p; p++) {
-		if (*p >= '0' && *p <= '9') {
-			n = n * 10 + (*p - '0');
-			if (n > 86400) oops_improper(argv[1]);
+	fd = open("/etc/machine-id", O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		n = read(fd, buf, sizeof(buf));
+		close(fd);
+	}
+	if (n <= 0) {
+		if (gethostname(buf, sizeof(buf)) != 0)
+			return 0;
+		buf[sizeof(buf) - 1] = '\0';
+		n = strlen(buf);
+	}
+	return fnv(FNV, buf, (size_t)n);
+}
 
-		} else {
-			oops_improper(argv[1]);
-		}
+/*
+   Pick a random amount (up to -j) to put the next run off by.
+ */
+static void
+jitter(struct job *job)
+{
+	uint64_t r;
+
+	if (!job->jitter)
+		return;
+	r = ((uint64_t)random() << 31) ^ (uint64_t)random();
+	job->fuzz = (long long)(r % (uint64_t)(job->jitter + 1));
+}
+
+/*
+   Set the overlap policy of `job` from `v`; returns 0 on
+   success, or -1 if `v` isn't a valid policy.
+ */
+static int
+overlap(struct job *job, const char *v)
+{
+	char *end;
+
+	if (eq(v, "skip")) {
+		job->overlap = SKIP;
+		job->limit = 1;
+
+	} else if (eq(v, "queue")) {
+		job->overlap = QUEUE;
+		job->limit = 1;
+
+	} else {
+		job->overlap = ALLOW;
+		job->limit = (int)strtol(v, &end, 10);
+		if (*end || end == v || job->limit < 1 || job->limit > 1024)
+			return -1;
 	}
+	return 0;
+}
 
-	if (!freopen("/dev/null", "r", stdin)) {
-		fprintf(stderr, PROGRAM ": failed to redirect /dev/null into stdin\n");
-		fclose(stdin);
+/*
+   All of the jobs are kept in HEAP, a binary min-heap ordered
+   on when they are next due, so that a single timer (armed for
+   whatever is at the top) covers all of them, and we only ever
+   wake up when something actually needs doing.  Each job knows
+   where it is in the heap (`pos`), so it can be moved when its
+   deadline changes.
+ */
+static struct job **HEAP;
+static size_t NHEAP;
+
+static void
+swap(size_t a, size_t b)
+{
+	struct job *t;
+
+	t = HEAP[a]; HEAP[a] = HEAP[b]; HEAP[b] = t;
+	HEAP[a]->pos = a;
+	HEAP[b]->pos = b;
+}
+
+/*
+   Move the job at `i` up or down the heap, until it's in the
+   right spot for its (new) deadline.
+ */
+static void
+sift(size_t i)
+{
+	size_t c;
+
+	while (i > 0 && HEAP[i]->deadline < HEAP[(i - 1) / 2]->deadline) {
+		swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
 	}
 	for (;;) {
-		use_clock = 1;
-		rc = clock_gettime(CLOCK_MONOTONIC, &end);
-		if (rc == 0) {
-			end.tv_sec += n;
-		} else {
-			fprintf(stderr, PROGRAM ": failed to get the current time: %s (error %d)\n", strerror(errno), errno);
-			use_clock = 0;
+		c = 2 * i + 1;
+		if (c >= NHEAP)
+			break;
+		if (c + 1 < NHEAP && HEAP[c + 1]->deadline < HEAP[c]->deadline)
+			c++;
+		if (HEAP[c]->deadline >= HEAP[i]->deadline)
+			break;
+		swap(i, c);
+		i = c;
+	}
+}
+
+/*
+   Running commands, by PID, so that when one exits we can find
+   its job without looking through all of them.  This is open-
+   addressed, with linear probing, and has NPIDS slots -- a power
+   of two, at least twice as many as could ever be running.
+ */
+static struct {
+	pid_t pid;
+	struct job *job;
+	long long started;
+} *PIDS;
+static size_t NPIDS;
+
+#define slot(pid) (((unsigned long)(pid) * 2654435761UL) & (NPIDS - 1))
+#define probe(i)  (((i) + 1) & (NPIDS - 1))
+
+static void
+track(pid_t pid, struct job *job)
+{
+	size_t s;
+
+	for (s = slot(pid); PIDS[s].pid; s = probe(s))
+		;
+	PIDS[s].pid = pid;
+	PIDS[s].job = job;
+	PIDS[s].started = now();
+}
+
+/*
+   Stop tracking `pid`, returning the job it belonged to (and
+   when it started), or NULL if it isn't one of ours.  Removal
+   shifts later entries in the probe sequence back, so that we
+   never need tombstones.
+ */
+static struct job *
+forget(pid_t pid, long long *started)
+{
+	struct job *job;
+	size_t s, t, home;
+
+	for (s = slot(pid); PIDS[s].pid; s = probe(s))
+		if (PIDS[s].pid == pid)
+			break;
+	if (!PIDS[s].pid)
+		return NULL;
+
+	job = PIDS[s].job;
+	*started = PIDS[s].started;
+	PIDS[s].pid = 0;
+	for (t = probe(s); PIDS[t].pid; t = probe(t)) {
+		home = slot(PIDS[t].pid);
+		/* can the entry at t move back into the hole at s? */
+		if ((t > s && (home <= s || home > t))
+		 || (t < s && (home <= s && home > t))) {
+			PIDS[s] = PIDS[t];
+			PIDS[t].pid = 0;
+			s = t;
+		}
+	}
+	return job;
+}
+
+/*
+   Work out when `job` is next due (on the boot-time clock),
+   and move it to its new place in the heap.
+
+   Cron jobs are due at a wall clock time, which we convert;
+   if someone sets the clock in the meantime, the watch timer
+   (see main) tells us to work them all out again.
+ */
+static void
+schedule(struct job *job)
+{
+	if (job->calendar)
+		job->deadline = now() + (job->at * NSEC + job->splay + job->fuzz - wallclock());
+	else
+		job->deadline = job->anchor + (long long)job->tick * job->interval + job->fuzz;
+	sift(job->pos);
+}
+
+/*
+   Arm `tfd` to go off when the job at the top of the heap is
+   next due.
+ */
+static void
+arm(int tfd)
+{
+	if (!NHEAP)
+		return;
+
+	if (rig_arm(tfd, HEAP[0]->deadline, 0, TFD_TIMER_ABSTIME) != 0)
+		oops_runtime("failed to set timer");
+	fprintf(debug, PROGRAM ": sleeping for %8.3lfs\n", (HEAP[0]->deadline - now()) / 1e9);
+}
+
+static void
+run(struct job *job, const sigset_t *mask)
+{
+	pid_t pid;
+
+	pid = rig_spawn(PROGRAM, job->argv, mask, NULL);
+	if (pid < 0) {
+		fprintf(stderr, PROGRAM ": fork() failed: %s (error %d)\n", strerror(errno), errno);
+		return;
+	}
+
+	track(pid, job);
+	job->running++;
+	job->runs++;
+	DIRTY = 1;
+}
+
+/*
+   `job` is due; figure out which tick we're on (noting any that
+   we missed entirely), run the command if the overlap policy
+   allows it, and schedule the next tick.
+ */
+static void
+due(struct job *job, const sigset_t *mask)
+{
+	unsigned long long tick, missed;
+	long long since;
+	time_t t, at;
+
+	if (job->calendar) {
+		t = (time_t)((wallclock() - job->splay - job->fuzz) / NSEC);
+		if (t < job->at) {
+			schedule(job);
+			return;
 		}
+		missed = 0;
+		for (at = cron_next(&job->cron, job->at); at != (time_t)-1 && at <= t; at = cron_next(&job->cron, at))
+			missed++;
+		job->at = at;
+		if (at == (time_t)-1)
+			oops_runtime("cron schedule ran out");
 
-		pid = fork();
-		if (pid < 0) oops_runtime("fork() failed");
-		if (pid == 0) {
-			execvp(argv[2], &argv[2]);
-			fprintf(stderr, PROGRAM ": failed to exec '%s': %s (error %d)\n", argv[2], strerror(errno), errno);
-			exit(EXIT_IN_CHILD);
+	} else {
+		since = now() - job->fuzz - job->anchor;
+		tick = since < 0 ? 0 : (unsigned long long)(since / job->interval);
+		if (since < 0 || tick < job->tick) {
+			/* woke up early; just go back to sleep */
+			schedule(job);
+			return;
 		}
+		missed = tick - job->tick;
+		job->tick = tick + 1;
+	}
+	jitter(job);
+
+	if (missed) {
+		job->missed += missed;
+		fprintf(stderr, PROGRAM ": missed %llu tick(s) of '%s' (%lu missed so far)\n",
+			missed, job->name, job->missed);
+	}
+
+	if (job->running < job->limit) {
+		run(job, mask);
+
+	} else if (job->overlap == QUEUE && !job->queued) {
+		fprintf(debug, PROGRAM ": '%s' is still running; queueing the next run\n", job->name);
+		job->queued = 1;
+
+	} else {
+		job->skipped++;
+		fprintf(stderr, PROGRAM ": '%s' is still running; skipping this run (%lu skipped so far)\n",
+			job->name, job->skipped);
+	}
+	schedule(job);
+}
+
+/*
+   Set `job` up for its first tick, which is right now, unless
+   it's a cron job (those wait for their time), or a splayed or
+   jittered one (those wait for their offset).
+ */
+static void
+start(struct job *job, const sigset_t *mask)
+{
+	uint64_t h;
+
+	if (job->splayed) {
+		/* jobs from a schedule file are spread out from
+		   one another, too, not just from other hosts. */
+		h = host();
+		if (job->line)
+			h = fnv(h, job->name, strlen(job->name));
+		job->splay = (long long)(mix(h) % (uint64_t)(job->calendar ? 60 * NSEC : job->interval));
+		fprintf(debug, PROGRAM ": splaying '%s' by %8.3lfs\n", job->name, job->splay / 1e9);
+	}
+	jitter(job);
+
+	job->anchor = now();
+	if (job->calendar) {
+		job->at = cron_next(&job->cron, time(NULL));
+		schedule(job);
+
+	} else if (job->splayed) {
+		job->anchor -= wallclock() % job->interval;
+		job->anchor += job->splay;
+		if (job->anchor > now())
+			job->anchor -= job->interval;
+		job->tick = 1;
+		schedule(job);
+
+	} else if (job->jitter) {
+		schedule(job);
+
+	} else {
+		due(job, mask);
+	}
+}
+
+static int
+ascending(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+   How long (in seconds) between runs of `job`?  For cron jobs,
+   that's the gap between the next run and the one after that.
+ */
+static double
+period(const struct job *job)
+{
+	time_t after;
+
+	if (!job->calendar)
+		return job->interval / 1e9;
+	after = cron_next(&job->cron, job->at);
+	return after == (time_t)-1 ? 0 : difftime(after, job->at);
+}
+
+/*
+   Take note of how long a run of `job` (which started at
+   `started`) took, and how much CPU / memory it used, then
+   work out the percentiles over the last RING runs, and warn
+   about the job, if it's getting too close to its interval.
+ */
+static void
+measure(struct job *job, long long started, const struct rusage *ru)
+{
+	double sorted[RING], wall, cpu, limit;
+	size_t i, n;
+
+	wall = (now() - started) / 1e9;
+	cpu  = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6
+	     + ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+
+	job->times[job->timed++ % RING] = wall;
+	job->wall += wall;
+	job->cpu  += cpu;
+	if (ru->ru_maxrss > job->rss)
+		job->rss = ru->ru_maxrss;
+
+	/* nearest-rank percentiles */
+	n = job->timed < RING ? job->timed : RING;
+	memcpy(sorted, job->times, n * sizeof(double));
+	qsort(sorted, n, sizeof(double), ascending);
+	i = (size_t)(0.50 * n + 0.999999); job->p50 = sorted[i ? i - 1 : 0];
+	i = (size_t)(0.90 * n + 0.999999); job->p90 = sorted[i ? i - 1 : 0];
+	i = (size_t)(0.99 * n + 0.999999); job->p99 = sorted[i ? i - 1 : 0];
+
+	fprintf(debug, PROGRAM ": '%s' ran for %.3fs (%.3fs cpu, %ldKiB max rss); "
+	               "p50 %.3fs, p90 %.3fs, p99 %.3fs over %lu run(s)\n",
+		job->name, wall, cpu, (long)ru->ru_maxrss, job->p50, job->p90, job->p99, (unsigned long)n);
+
+	if (!job->warn)
+		return;
+	limit = job->warn * period(job);
+	if (job->p99 > limit && !job->slow) {
+		fprintf(stderr, PROGRAM ": '%s' is running slow: p99 of %.3fs is over %g%% of its %.3fs interval\n",
+			job->name, job->p99, job->warn * 100, period(job));
+		job->slow = 1;
+
+	} else if (job->p99 <= limit && job->slow) {
+		fprintf(stderr, PROGRAM ": '%s' is back up to speed: p99 of %.3fs\n", job->name, job->p99);
+		job->slow = 0;
+	}
+}
+
+/*
+   Reap any finished runs, reporting on the ones that failed,
+   and start queued runs, if there are any.
+ */
+static void
+reap(const sigset_t *mask)
+{
+	struct rusage ru;
+	struct job *job;
+	long long started;
+	pid_t pid;
+	int rc;
+
+	while ((pid = wait4(-1, &rc, WNOHANG, &ru)) > 0) {
+		rig_trace(exit, pid, rc);
+		job = forget(pid, &started);
+		if (!job)
+			continue;
+		job->running--;
+		measure(job, started, &ru);
+		DIRTY = 1;
 
-		if (waitpid(pid, &rc, 0) < 0) oops_runtime("waitpid() failed");
 		if (rc != 0) {
-			if (WIFEXITED(rc) && WEXITSTATUS(rc) != EXIT_IN_CHILD) {
-				fprintf(stderr, PROGRAM ": command '%s' exited with rc=%d\n", argv[2], WEXITSTATUS(rc));
+			job->failed++;
+			fprintf(stderr, PROGRAM ": command '%s' %s (%lu of %lu runs failed)\n",
+				job->name, rig_status(rc), job->failed, job->runs);
+		}
+
+		if (job->queued && job->running < job->limit) {
+			job->queued = 0;
+			run(job, mask);
+		}
+	}
+}
+
+/*
+   Parse a -w fraction; returns -1 if it's no good.
+ */
+static double
+fraction(const char *v)
+{
+	char *end;
+	double f;
+
+	f = strtod(v, &end);
+	if (*end || end == v || !(f > 0))
+		return -1;
+	return f;
+}
+
+/*
+   Print a label value, escaped per the exposition format.
+ */
+static void
+label(FILE *io, const char *v)
+{
+	for (; *v; v++) {
+		if (*v == '\\' || *v == '"')
+			fputc('\\', io);
+		if (*v == '\n') fputs("\\n", io);
+		else             fputc(*v, io);
+	}
+}
 
-			} else if (WIFSIGNALED(rc)) {
-				fprintf(stderr, PROGRAM ": command '%s' killed with signal %d\n", argv[2], WTERMSIG(rc));
+#define METRIC(io,name,command,fmt,v) do { \
+	fprintf((io), name "{command=\""); \
+	label((io), (command)); \
+	fprintf((io), "\"} " fmt "\n", (v)); \
+} while (0)
+
+#define QUANTILE(io,command,q,v) do { \
+	fprintf((io), "every_run_seconds{command=\""); \
+	label((io), (command)); \
+	fprintf((io), "\",quantile=\"" q "\"} %.6f\n", (v)); \
+} while (0)
+
+/*
+   Write out all of our stats, in the Prometheus text format.
+ */
+static void
+metrics(FILE *io)
+{
+	struct job *job;
+	size_t i;
+
+	fprintf(io, "# HELP every_jobs Number of jobs being scheduled.\n"
+	            "# TYPE every_jobs gauge\n"
+	            "every_jobs %lu\n", (unsigned long)NJOBS);
+
+#define EACH(help, type, metric, fmt, expr) \
+	fprintf(io, "# HELP " metric " " help "\n# TYPE " metric " " type "\n"); \
+	for (i = 0; i < NJOBS; i++) { \
+		job = &JOBS[i]; \
+		METRIC(io, metric, job->name, fmt, (expr)); \
+	}
+
+	EACH("Runs started.", "counter",
+	     "every_runs_total", "%lu", job->runs);
+	EACH("Runs that didn't exit 0.", "counter",
+	     "every_failures_total", "%lu", job->failed);
+	EACH("Ticks skipped, because the last run was still going.", "counter",
+	     "every_skipped_total", "%lu", job->skipped);
+	EACH("Ticks missed entirely (i.e. while suspended).", "counter",
+	     "every_missed_total", "%lu", job->missed);
+	EACH("Runs going right now.", "gauge",
+	     "every_running", "%d", job->running);
+	EACH("CPU time (user + system) used by all runs.", "counter",
+	     "every_run_cpu_seconds_total", "%.6f", job->cpu);
+	EACH("Biggest maximum resident set size of any run.", "gauge",
+	     "every_run_max_rss_bytes", "%ld", job->rss * 1024L);
+	EACH("Whether p99 run time is over the -w fraction of the interval.", "gauge",
+	     "every_slow", "%d", job->slow);
+#undef EACH
+
+	fprintf(io, "# HELP every_run_seconds How long runs took (quantiles over the last %d).\n"
+	            "# TYPE every_run_seconds summary\n", RING);
+	for (i = 0; i < NJOBS; i++) {
+		job = &JOBS[i];
+		if (job->timed) {
+			QUANTILE(io, job->name, "0.5", job->p50);
+			QUANTILE(io, job->name, "0.9", job->p90);
+			QUANTILE(io, job->name, "0.99", job->p99);
+		}
+		METRIC(io, "every_run_seconds_sum",   job->name, "%.6f", job->wall);
+		METRIC(io, "every_run_seconds_count", job->name, "%lu",  job->timed);
+	}
+}
+
+/*
+   Write the stats out to STATS, via a temporary file, which
+   we then rename into place, so that nobody ever reads half
+   of an update.
+ */
+static void
+dump(void)
+{
+	char tmp[4096];
+	FILE *io;
+
+	DIRTY = 0;
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", STATS) >= (int)sizeof(tmp))
+		return;
+
+	io = fopen(tmp, "w");
+	if (!io) {
+		fprintf(stderr, PROGRAM ": failed to write stats to %s: %s (error %d)\n", tmp, strerror(errno), errno);
+		return;
+	}
+	metrics(io);
+	if (fclose(io) != 0 || rename(tmp, STATS) != 0) {
+		fprintf(stderr, PROGRAM ": failed to write stats to %s: %s (error %d)\n", STATS, strerror(errno), errno);
+		unlink(tmp);
+	}
+}
+
+/*
+   Pull the next whitespace-delimited word off of `*p`,
+   terminating it in place.
+ */
+static char *
+word(char **p)
+{
+	char *w;
+
+	while (isspace((unsigned char)**p)) (*p)++;
+	w = *p;
+	while (**p && !isspace((unsigned char)**p)) (*p)++;
+	if (**p)
+		*(*p)++ = '\0';
+	return w;
+}
+
+static void
+bad(const char *path, int line, const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, PROGRAM ": %s:%d: ", path, line);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(EXIT_IMPROPER);
+}
+
+/*
+   Read the schedule file at `path` into JOBS, starting each
+   job off with the defaults in `proto` (from the command-line).
+
+   Each line looks like this:
+
+       N [OPTIONS...] command...
+       cron MIN HOUR DAY MONTH WEEKDAY [OPTIONS...] command...
+
+   where OPTIONS are `overlap=POLICY', `jitter=J', `warn=F' and
+   `splay'.
+   The command is everything else on the line, and is run via
+   /bin/sh -c.  Blank lines, and lines starting with `#', are
+   ignored.
+ */
+static void
+load(const char *path, const struct job *proto)
+{
+	struct job *job;
+	struct stat st;
+	char *buf, *p, *next, *v, *end;
+	size_t n, len;
+	ssize_t nread;
+	int fd, line;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		fprintf(stderr, PROGRAM ": failed to open %s: %s (error %d)\n", path, strerror(errno), errno);
+		exit(EXIT_IMPROPER);
+	}
+
+	/* one buffer for the whole file; commands point into it */
+	buf = malloc(st.st_size + 1);
+	if (!buf)
+		oops_runtime("failed to allocate memory");
+	for (len = 0; len < (size_t)st.st_size; len += nread) {
+		nread = read(fd, buf + len, st.st_size - len);
+		if (nread < 0) oops_runtime("failed to read schedule file");
+		if (nread == 0) break;
+	}
+	buf[len] = '\0';
+	close(fd);
+
+	for (n = 1, p = buf; *p; p++)
+		if (*p == '\n') n++;
+	JOBS = calloc(n, sizeof(struct job));
+	if (!JOBS)
+		oops_runtime("failed to allocate memory");
+
+	NJOBS = 0;
+	for (line = 1, p = buf; p; p = next, line++) {
+		next = strchr(p, '\n');
+		if (next) *next++ = '\0';
+
+		while (isspace((unsigned char)*p)) p++;
+		if (!*p || *p == '#')
+			continue;
+
+		job = &JOBS[NJOBS];
+		*job = *proto;
+		job->line = line;
+
+		if (!strncmp(p, "cron", 4) && isspace((unsigned char)p[4])) {
+			for (v = p + 4; isspace((unsigned char)*v); v++)
+				;
+			p = v;
+			if (cronspec(&job->cron, (const char **)&p) != 0)
+				bad(path, line, "invalid cron expression in '%s'", v);
+			job->calendar = 1;
+			if (cron_next(&job->cron, time(NULL)) == (time_t)-1) {
+				*p = '\0';
+				bad(path, line, "cron expression '%s' never matches anything", v);
+			}
+		} else {
+			v = word(&p);
+			job->interval = interval(v);
+			if (job->interval < 0)
+				bad(path, line, "invalid interval '%s' (must be between 1ms and 24h, inclusive)", v);
+		}
+
+		for (;;) {
+			while (isspace((unsigned char)*p)) p++;
+			if (!strncmp(p, "overlap=", 8)) {
+				v = word(&p);
+				if (overlap(job, v + 8) != 0)
+					bad(path, line, "invalid overlap policy '%s' (must be skip, queue, or 1-1024)", v + 8);
+
+			} else if (!strncmp(p, "jitter=", 7)) {
+				v = word(&p);
+				job->jitter = interval(v + 7);
+				if (job->jitter < 0)
+					bad(path, line, "invalid jitter '%s' (must be between 1ms and 24h, inclusive)", v + 7);
+
+			} else if (!strncmp(p, "warn=", 5)) {
+				v = word(&p);
+				job->warn = fraction(v + 5);
+				if (job->warn < 0)
+					bad(path, line, "invalid warn fraction '%s' (must be more than 0)", v + 5);
+
+			} else if (!strncmp(p, "splay", 5) && (!p[5] || isspace((unsigned char)p[5]))) {
+				word(&p);
+				job->splayed = 1;
 
 			} else {
-				fprintf(stderr, PROGRAM ": command '%s' died with unrecognized status of %d (%08x)\n", argv[2], rc, rc);
+				break;
 			}
 		}
 
-		if (use_clock) {
-			rc = clock_gettime(CLOCK_MONOTONIC, &start);
-			if (rc < 0) {
-				fprintf(stderr, PROGRAM ": failed to get the current time: %s (error %d)\n", strerror(errno), errno);
-				sleep(n);
+		end = p + strlen(p);
+		while (end > p && isspace((unsigned char)end[-1]))
+			*--end = '\0';
+		if (!*p)
+			bad(path, line, "missing command");
+
+		job->name = p;
+		job->argv = calloc(4, sizeof(char *));
+		if (!job->argv)
+			oops_runtime("failed to allocate memory");
+		job->argv[0] = "/bin/sh";
+		job->argv[1] = "-c";
+		job->argv[2] = p;
+		NJOBS++;
+	}
+
+	if (!NJOBS) {
+		fprintf(stderr, PROGRAM ": %s: no jobs to schedule\n", path);
+		exit(EXIT_IMPROPER);
+	}
+}
+
+/*
+   Re-arm the watch timer, which never really goes off; we only
+   want to hear about it (via ECANCELED) if the clock gets set.
+ */
+static void
+rewatch(int wfd)
+{
+	long long at;
+
+	at = ((long long)time(NULL) + 86400) * NSEC;
+	if (rig_arm(wfd, at, 0, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET) != 0)
+		oops_runtime("failed to set clock watch timer");
+}
+
+static sigset_t MASK; /* what the signalfd handles */
+static int TIMER;     /* goes off when HEAP[0] is due */
+
+/*
+   Handlers for the main loop: SIGCHLD (via the signalfd), the
+   timer, and the clock watch timer (for cron schedules).
+ */
+static void
+signalled(int fd, unsigned events, void *data)
+{
+	(void)events; (void)data;
+	while (rig_signal(fd) != 0)
+		;
+	reap(&MASK);
+}
+
+static void
+woke(int fd, unsigned events, void *data)
+{
+	(void)events; (void)data;
+	if (rig_ticks(fd) > 0)
+		while (NHEAP && HEAP[0]->deadline <= now())
+			due(HEAP[0], &MASK);
+	arm(fd);
+}
+
+static void
+clockset(int fd, unsigned events, void *data)
+{
+	size_t i;
+
+	(void)events; (void)data;
+	if (rig_ticks(fd) < 0 && errno == ECANCELED) {
+		fprintf(debug, PROGRAM ": system clock changed; rescheduling\n");
+		for (i = 0; i < NJOBS; i++) {
+			if (!JOBS[i].calendar)
 				continue;
+			JOBS[i].at = cron_next(&JOBS[i].cron, time(NULL));
+			schedule(&JOBS[i]);
+		}
+		arm(TIMER);
+	}
+	rewatch(fd);
+}
+
+int main(int argc, char **argv)
+{
+	struct job job;
+	const char *file;
+	size_t i, n;
+	int calendar, sfd, wfd;
+
+	file = NULL;
+	memset(&job, 0, sizeof(job));
+	job.overlap = QUEUE;
+	job.limit = 1;
+
+	if (argc > 1 && eq(argv[1], "-v")) show_version(PROGRAM);
+	while (argc > 2 && argv[1][0] == '-') {
+		if (eq(argv[1], "-s")) {
+			job.splayed = 1;
+			argc--; argv++;
+			continue;
+		}
+
+		if (eq(argv[1], "-o")) {
+			if (overlap(&job, argv[2]) != 0) {
+				fprintf(stderr, PROGRAM ": invalid overlap policy '%s' (must be skip, queue, or 1-1024)\n", argv[2]);
+				exit(EXIT_IMPROPER);
 			}
-			if (end.tv_nsec < start.tv_nsec) {
-				end.tv_sec--;
-				end.tv_nsec += 1000000000;
+		}
+		else if (eq(argv[1], "-c")) crontab(&job, argv[2]);
+		else if (eq(argv[1], "-f")) file = argv[2];
+		else if (eq(argv[1], "-S")) STATS = argv[2];
+		else if (eq(argv[1], "-w")) {
+			job.warn = fraction(argv[2]);
+			if (job.warn < 0) {
+				fprintf(stderr, PROGRAM ": invalid warn fraction '%s' (must be more than 0)\n", argv[2]);
+				exit(EXIT_IMPROPER);
 			}
-			nap.tv_sec  = end.tv_sec  - start.tv_sec;
-			nap.tv_nsec = end.tv_nsec - start.tv_nsec;
-naptime:
-			fprintf(debug, PROGRAM ": sleeping for %8.3lfs\n", nap.tv_sec + (nap.tv_nsec / 1000000000.0));
-			rc = nanosleep(&nap, &end);
-			if (rc < 0) {
-				if (errno == EINTR) {
-					fprintf(debug, PROGRAM ": interrupted by signal; resuming nap...\n");
-					memcpy(&nap, &end, sizeof(nap));
-					goto naptime;
-				}
-				fprintf(stderr, PROGRAM ": failed to sleep: %s (error %d)\n", strerror(errno), errno);
+		}
+		else if (eq(argv[1], "-j")) {
+			job.jitter = interval(argv[2]);
+			if (job.jitter < 0) {
+				fprintf(stderr, PROGRAM ": invalid jitter '%s' (must be between 1ms and 24h, inclusive)\n", argv[2]);
+				exit(EXIT_IMPROPER);
 			}
+		}
+		else usage();
+		argc -= 2; argv += 2;
+	}
 
-		} else {
-			sleep(n);
+	if (file) {
+		if (argc != 1 || job.calendar)
+			usage();
+
+	} else {
+		if (job.calendar) {
+			/* there's no N; make it look like there was */
+			argc++; argv--;
 		}
+		if (argc > 1 && argv[1][0] == '-')
+			usage();
+		if (argc < 3)
+			usage();
+	}
+
+	if (fcntl(3, F_GETFD) >= 0) {
+		debug = fdopen(3, "w");
+		setvbuf(debug, NULL, _IOLBF, 0);
+	} else {
+		debug = fopen("/dev/null", "w");
+	}
+
+	if (file) {
+		load(file, &job);
+
+	} else {
+		if (!job.calendar) {
+			job.interval = interval(argv[1]);
+			if (job.interval < 0) oops_improper(argv[1]);
+		}
+		job.argv = &argv[2];
+		job.name = argv[2];
+		JOBS = &job;
+		NJOBS = 1;
+	}
+
+	/* everything goes on the heap, all due at once (for now) */
+	HEAP = calloc(NJOBS, sizeof(struct job *));
+	if (!HEAP)
+		oops_runtime("failed to allocate memory");
+	calendar = 0;
+	for (n = 0, i = 0; i < NJOBS; i++) {
+		HEAP[i] = &JOBS[i];
+		JOBS[i].pos = i;
+		n += JOBS[i].limit;
+		calendar |= JOBS[i].calendar;
+	}
+	NHEAP = NJOBS;
+
+	for (NPIDS = 8; NPIDS < n * 2; NPIDS *= 2)
+		;
+	PIDS = calloc(NPIDS, sizeof(*PIDS));
+	if (!PIDS)
+		oops_runtime("failed to allocate memory");
+
+	if (!freopen("/dev/null", "r", stdin)) {
+		fprintf(stderr, PROGRAM ": failed to redirect /dev/null into stdin\n");
+		fclose(stdin);
+	}
+
+	sigemptyset(&MASK);
+	sigaddset(&MASK, SIGCHLD);
+	sfd = rig_signalfd(&MASK);
+	if (sfd < 0 || rig_watch(sfd, EPOLLIN, signalled, NULL) != 0)
+		oops_runtime("failed to set up signal handling");
+	TIMER = rig_timer(CLOCK_BOOTTIME); /* see now() */
+	if (TIMER < 0 || rig_watch(TIMER, EPOLLIN, woke, NULL) != 0)
+		oops_runtime("failed to set up timer");
+	if (calendar) {
+		wfd = rig_timer(CLOCK_REALTIME);
+		if (wfd < 0 || rig_watch(wfd, EPOLLIN, clockset, NULL) != 0)
+			oops_runtime("failed to set up clock watch timer");
+		rewatch(wfd);
+	}
+
+	srandom((unsigned)(time(NULL) ^ getpid() ^ mix(host())));
+	for (i = 0; i < NJOBS; i++)
+		start(&JOBS[i], &MASK);
+	arm(TIMER);
+
+	for (;;) {
+		if (STATS && DIRTY)
+			dump();
+
+		if (rig_dispatch(-1) < 0)
+			oops_runtime("epoll_wait() failed");
 	}
 
 	return 0;
@@ -23,9 +23,33 @@
 
    init - An initial process for bootstrapping a running system
 
-   USAGE: init [/etc/inittab]
+   USAGE: init [-s] [-t SECONDS] [-m /path/to/socket] [/etc/inittab]
           init -v
 
+   Sending init a SIGHUP causes it to re-read its inittab.  Commands
+   that are still listed keep running (under the same PID); commands
+   that were added get started; commands that were removed are sent
+   a SIGTERM and are not restarted.
+
+   A SIGTERM or SIGINT shuts init down: nothing gets restarted,
+   every child is sent a SIGTERM (all at once), and init waits
+   up to SECONDS (default 10) for them to exit.  Anything still
+   running after that gets a SIGKILL.  init exits 0 if all of its
+   children exited on their own, and 2 if it had to kill any.
+
+   With -m, init listens on a UNIX domain socket, and writes out
+   per-child metrics (start / restart / exit counters, and
+   histograms of fork-to-exec latency and uptime) in Prometheus'
+   text exposition format to anyone who connects to it.  Scrapers
+   get a second to read it all, before init hangs up on them.
+
+   With -s, init marks itself as a child subreaper, so that it
+   can supervise (and reap) a whole process tree without being
+   PID 1.  Every command is started in its own session, and any
+   orphan reaped is attributed to the inittab entry whose session
+   it belongs to.  On reload / shutdown, the whole session gets
+   signalled, not just the top-level process.
+
  */
 
 #include "rig.h"
@@ -35,11 +59,20 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
 #include <unistd.h>
 #include <signal.h>
+#include <stdint.h>
 #include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #define PROGRAM "init"
 
@@ -48,24 +81,268 @@
    child processes that we are supervising.  Partially, this
    configuration comes from the inittab, but it also stores the
    running state of the child process, in the `pid` member.
-
-   This is inherently list-like, since we probably need to
-   supervisor more than one child process (otherwise, we wouldn't
-   actually _need_ init in the first place, now would we?)
  */
 struct child {
-	struct child *next; /* the rest of the linked list */
-	                    /* (NULL at end-of-list)       */
-
 	char *command;      /* command script to run       */
+	                    /* (points into the arena)     */
 
 	pid_t pid;          /* PID of the running process. */
 	                    /* set to 0 for "not running"  */
+
+	int claimed;        /* set during reconfiguration, */
+	                    /* once this entry is matched  */
+	                    /* (to its new index + 1)      */
+
+	int exec;           /* read end of the exec pipe,  */
+	                    /* or -1 once exec'd / failed  */
+
+	struct timespec started; /* when we forked it      */
+};
+
+/*
+   Histogram buckets (upper bounds, in seconds) for the metrics
+   we keep on each child; a final +Inf bucket is implied.
+ */
+#define NBUCKETS 10
+static const double EXEC_LE[NBUCKETS] = {
+	0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.1, 1.0
+};
+static const double UPTIME_LE[NBUCKETS] = {
+	1, 5, 10, 30, 60, 300, 900, 3600, 21600, 86400
+};
+
+struct histogram {
+	unsigned long bucket[NBUCKETS + 1]; /* not cumulative */
+	unsigned long count;
+	double sum;
+};
+
+/*
+   `struct stats` holds the metrics for a single child.  These
+   are kept apart from the `child` array, so that the reaper and
+   the main loop don't have to drag them through the cache.
+ */
+struct stats {
+	unsigned long starts;    /* times we forked it          */
+	unsigned long failures;  /* times the exec() failed     */
+	unsigned long exits;     /* times it exited, one way or */
+	                         /* another                     */
+
+	unsigned long minute;    /* restarts[0] is for this     */
+	unsigned long restarts[2]; /* minute; [1] for the last  */
+
+	unsigned long orphans;   /* descendants we reaped       */
+
+	struct histogram exec;   /* fork -> exec latency        */
+	struct histogram uptime; /* fork -> exit                */
+};
+
+/*
+   `struct session` ties a session ID back to the inittab entry
+   whose process started it.  Sessions can outlive their leader,
+   so these are tracked separately from the children's PIDs.
+ */
+struct session {
+	pid_t  sid;    /* session ID; 0 = empty slot  */
+	size_t child;  /* which child it descends from */
+	int    live;   /* seen in /proc (see sweep()) */
+};
+
+/*
+   `struct config` is the whole inittab.
+
+   We probably need to supervise more than one child process
+   (otherwise, we wouldn't actually _need_ init in the first
+   place, now would we?), and sometimes we supervise thousands
+   of them.  So the children live in one contiguous array, and
+   their commands live in one arena (the inittab itself, read
+   into memory whole and chopped up in place).
+
+   Exits are matched up to children through `pids`, an open-
+   addressed hash table (with linear probing) of child indices,
+   offset by one so that zero can mean "empty".  It is sized to
+   a power of two at least twice as big as the number of
+   children, so it never gets more than half full.
+
+   `sessions` works the same way, but keyed by session ID, and
+   grows as needed (a child that gets restarted while its last
+   session is still populated will have two).
+ */
+struct config {
+	char         *arena;  /* the inittab, NUL-separated     */
+	struct child *child;  /* all of the children            */
+	struct stats *stats;  /* ... and their metrics          */
+	size_t        n;      /* how many children there are    */
+
+	size_t       *pids;   /* pid -> (child index + 1)       */
+	size_t        size;   /* number of slots in `pids`      */
+
+	struct session *sessions; /* sid -> child index         */
+	size_t          nsessions;
+	size_t          ssize;    /* slots in `sessions`        */
 };
 
+#define slot(cfg,pid) (((unsigned long)(pid) * 2654435761UL) & ((cfg)->size - 1))
+#define probe(cfg,i)   (((i) + 1) & ((cfg)->size - 1))
+
+/*
+   Start tracking child `i` under its (freshly forked) PID.
+ */
+static void track(struct config *cfg, size_t i)
+{
+	size_t s;
+
+	for (s = slot(cfg, cfg->child[i].pid); cfg->pids[s]; s = probe(cfg, s))
+		;
+	cfg->pids[s] = i + 1;
+}
+
+/*
+   Find the child running as `pid`, returning its index,
+   or -1 if it isn't one of ours.
+ */
+static long lookup(struct config *cfg, pid_t pid)
+{
+	size_t s;
+
+	for (s = slot(cfg, pid); cfg->pids[s]; s = probe(cfg, s))
+		if (cfg->child[cfg->pids[s] - 1].pid == pid)
+			return (long)(cfg->pids[s] - 1);
+	return -1;
+}
+
+/*
+   Stop tracking `pid`, returning the index of the child it
+   belonged to, or -1 if it isn't one of ours.
+
+   Removal shifts later entries in the probe sequence back,
+   so that we never need tombstones.
+ */
+static long forget(struct config *cfg, pid_t pid)
+{
+	size_t s, t, home, i;
+
+	for (s = slot(cfg, pid); cfg->pids[s]; s = probe(cfg, s))
+		if (cfg->child[cfg->pids[s] - 1].pid == pid)
+			break;
+	if (!cfg->pids[s])
+		return -1;
+
+	i = cfg->pids[s] - 1;
+	cfg->pids[s] = 0;
+	for (t = probe(cfg, s); cfg->pids[t]; t = probe(cfg, t)) {
+		home = slot(cfg, cfg->child[cfg->pids[t] - 1].pid);
+		/* can the entry at t move back into the hole at s? */
+		if ((t > s && (home <= s || home > t))
+		 || (t < s && (home <= s && home > t))) {
+			cfg->pids[s] = cfg->pids[t];
+			cfg->pids[t] = 0;
+			s = t;
+		}
+	}
+	return (long)i;
+}
+
+#define sslot(cfg,sid) (((unsigned long)(sid) * 2654435761UL) & ((cfg)->ssize - 1))
+#define sprobe(cfg,i)  (((i) + 1) & ((cfg)->ssize - 1))
+
+/*
+   Remember that session `sid` descends from child `i`.
+   Returns 0 on success, -1 if we ran out of memory.
+ */
+static int adopt(struct config *cfg, pid_t sid, size_t i)
+{
+	struct session *old;
+	size_t s, n, size;
+
+	if (cfg->nsessions * 2 >= cfg->ssize) {
+		old  = cfg->sessions;
+		size = cfg->ssize;
+		cfg->sessions = calloc(size * 2, sizeof(struct session));
+		if (!cfg->sessions) {
+			cfg->sessions = old;
+			return -1;
+		}
+		cfg->ssize = size * 2;
+		for (n = 0; n < size; n++) {
+			if (!old[n].sid)
+				continue;
+			for (s = sslot(cfg, old[n].sid); cfg->sessions[s].sid; s = sprobe(cfg, s))
+				;
+			cfg->sessions[s] = old[n];
+		}
+		free(old);
+	}
+
+	for (s = sslot(cfg, sid); cfg->sessions[s].sid; s = sprobe(cfg, s))
+		if (cfg->sessions[s].sid == sid)
+			break;
+	if (!cfg->sessions[s].sid)
+		cfg->nsessions++;
+	cfg->sessions[s].sid = sid;
+	cfg->sessions[s].child = i;
+	return 0;
+}
+
+/*
+   Find the child that session `sid` descends from, returning
+   its index, or -1 if the session isn't one we know about.
+ */
+static long descent(struct config *cfg, pid_t sid)
+{
+	size_t s;
+
+	for (s = sslot(cfg, sid); cfg->sessions[s].sid; s = sprobe(cfg, s))
+		if (cfg->sessions[s].sid == sid)
+			return (long)cfg->sessions[s].child;
+	return -1;
+}
+
+/*
+   Forget about session `sid` (see forget(), above).
+ */
+static void disown(struct config *cfg, pid_t sid)
+{
+	size_t s, t, home;
+
+	for (s = sslot(cfg, sid); cfg->sessions[s].sid; s = sprobe(cfg, s))
+		if (cfg->sessions[s].sid == sid)
+			break;
+	if (!cfg->sessions[s].sid)
+		return;
+
+	cfg->sessions[s].sid = 0;
+	cfg->nsessions--;
+	for (t = sprobe(cfg, s); cfg->sessions[t].sid; t = sprobe(cfg, t)) {
+		home = sslot(cfg, cfg->sessions[t].sid);
+		if ((t > s && (home <= s || home > t))
+		 || (t < s && (home <= s && home > t))) {
+			cfg->sessions[s] = cfg->sessions[t];
+			cfg->sessions[t].sid = 0;
+			s = t;
+		}
+	}
+}
+
+/*
+   Free all of the memory held by a `config`, as returned by
+   configure().  Running processes are left alone.
+ */
+static void release(struct config *cfg)
+{
+	if (!cfg)
+		return;
+	free(cfg->arena);
+	free(cfg->child);
+	free(cfg->stats);
+	free(cfg->pids);
+	free(cfg->sessions);
+	free(cfg);
+}
+
 /*
    Given the path to an inittab, parse the file and return a
-   heap-allocated `child` structure that contains all of the
+   heap-allocated `config` structure that contains all of the
    pertinent details from the inittab.
 
    Handles comments, blank lines, etc.
@@ -73,12 +350,14 @@ struct child {
    Any errors will cause the parsing to terminate, and a NULL
    pointer will be returned.  (i.e. NULL = bad config)
  */
-struct child* configure(const char *path)
+static struct config* configure(const char *path)
 {
 	FILE *f;
-	char buf[8192], *p, *q;
+	struct stat st;
+	struct config *cfg;
+	char *p, *q, *eol;
 	unsigned long line;
-	struct child *chain, *next;
+	size_t len, cap;
 
 	f = fopen(path, "r");
 	if (!f) {
@@ -86,19 +365,41 @@ struct child* configure(const char *path)
 		return NULL;
 	}
 
+	cfg = calloc(1, sizeof(struct config));
+	if (!cfg || fstat(fileno(f), &st) != 0)
+		goto oom;
+
+	/* slurp the whole file; it becomes the arena */
+	cap = st.st_size > 0 ? (size_t)st.st_size : 8192;
+	cfg->arena = malloc(cap + 1);
+	if (!cfg->arena)
+		goto oom;
+	len = 0;
+	for (;;) {
+		len += fread(cfg->arena + len, 1, cap - len, f);
+		if (len < cap)
+			break;
+		p = realloc(cfg->arena, cap * 2 + 1);
+		if (!p)
+			goto oom;
+		cfg->arena = p;
+		cap *= 2;
+	}
+	if (ferror(f)) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		goto fail;
+	}
+	cfg->arena[len] = '\0';
+
+	cap = 0;
 	line = 0;
-	chain = next = NULL;
-	while (fgets(buf, 8192, f) != NULL) {
+	for (p = cfg->arena; p < cfg->arena + len; p = eol + 1) {
 		line++;
-		p = strrchr(buf, '\n');
-		if (!p && buf[8190]) {
-			fprintf(stderr, "%s:%lu: line is too long!\n", path, line);
-			return NULL;
-		}
-		if (p)
-			*p = '\0';
+		eol = memchr(p, '\n', cfg->arena + len - p);
+		if (!eol)
+			eol = cfg->arena + len;
+		*eol = '\0';
 
-		p = buf;
 		while (*p && isspace(*p))
 			p++;
 		if (!*p || *p == '#')
@@ -107,7 +408,7 @@ struct child* configure(const char *path)
 		if (*p != '/') {
 			fprintf(stderr, "%s:%lu: command '%s' must be absolutely qualified\n",
 			                path, line, p);
-			return NULL;
+			goto fail;
 		}
 
 		for (q = p; *q && !isspace(*q) && isprint(*q); q++)
@@ -118,40 +419,180 @@ struct child* configure(const char *path)
 			                "            %*s^~~ problem starts here...\n",
 			                path, line, p,
 			                pad, " ");
-			return NULL;
+			goto fail;
 		}
 
-		if (next == NULL) {
-			chain = next = calloc(1, sizeof(struct child));
-		} else {
-			struct child *tmp = next;
-			next = calloc(1, sizeof(struct child));
-			tmp->next = next;
+		if (cfg->n == cap) {
+			struct child *more;
+			cap = cap ? cap * 2 : 64;
+			more = realloc(cfg->child, cap * sizeof(struct child));
+			if (!more)
+				goto oom;
+			cfg->child = more;
 		}
-		next->command = strdup(p);
+		memset(&cfg->child[cfg->n], 0, sizeof(struct child));
+		cfg->child[cfg->n].exec = -1;
+		cfg->child[cfg->n++].command = p;
 	}
+	fclose(f);
 
-	next = chain;
-	while (next) {
-		fprintf(stderr, "- [%s]\n", next->command);
-		next = next->next;
+	if (!cfg->n) {
+		fprintf(stderr, "%s: no commands defined.\nWhat shall I supervise?\n", path);
+		release(cfg);
+		return NULL;
 	}
 
-	fclose(f);
-	if (!chain) {
-		fprintf(stderr, "%s: no commands defined.\nWhat shall I supervise?\n", path);
+	for (cfg->size = 16; cfg->size < cfg->n * 2; cfg->size *= 2)
+		;
+	cfg->ssize = cfg->size;
+	cfg->pids  = calloc(cfg->size, sizeof(size_t));
+	cfg->stats = calloc(cfg->n, sizeof(struct stats));
+	cfg->sessions = calloc(cfg->ssize, sizeof(struct session));
+	if (!cfg->pids || !cfg->stats || !cfg->sessions) {
+		fprintf(stderr, "%s: out of memory\n", path);
+		release(cfg);
 		return NULL;
 	}
 
-	return chain;
+	for (len = 0; len < cfg->n; len++)
+		fprintf(stderr, "- [%s]\n", cfg->child[len].command);
+
+	return cfg;
+
+oom:
+	fprintf(stderr, "%s: out of memory\n", path);
+fail:
+	fclose(f);
+	release(cfg);
+	return NULL;
+}
+
+static struct config *CONFIG;
+static int METRICS = -1; /* listening socket for -m        */
+static int SUBREAPER;    /* are we a subreaper? (-s)       */
+static unsigned long ORPHANS; /* reaped, lineage unknown   */
+
+static double
+elapsed(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+static void
+observe(struct histogram *h, const double *le, double v)
+{
+	int i;
+
+	for (i = 0; i < NBUCKETS && v > le[i]; i++)
+		;
+	h->bucket[i]++;
+	h->count++;
+	h->sum += v;
+}
+
+/*
+   Restarts are counted per wall-clock minute (on the monotonic
+   clock), keeping the previous minute around so that we can
+   report a sliding per-minute rate.
+ */
+static unsigned long
+minute(double *frac)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (frac)
+		*frac = (now.tv_sec % 60 + now.tv_nsec / 1e9) / 60.0;
+	return (unsigned long)now.tv_sec / 60;
+}
+
+static void
+roll(struct stats *st, unsigned long now)
+{
+	if (st->minute == now)
+		return;
+	st->restarts[1] = st->minute + 1 == now ? st->restarts[0] : 0;
+	st->restarts[0] = 0;
+	st->minute = now;
 }
 
-void spin(struct child *config)
+/*
+   Finish up with the exec pipe of child `i`.  The child writes
+   its errno down the pipe if the exec fails; if the exec works,
+   the pipe just closes (it's close-on-exec), and we read EOF.
+ */
+static void
+execd(struct config *cfg, size_t i)
+{
+	struct child *c = &cfg->child[i];
+	int err;
+
+	if (c->exec < 0)
+		return;
+
+	if (read(c->exec, &err, sizeof(err)) == sizeof(err)) {
+		cfg->stats[i].failures++;
+		fprintf(stderr, "pid %d `%s` failed to exec: %s\n", c->pid, c->command, strerror(err));
+	} else {
+		observe(&cfg->stats[i].exec, EXEC_LE, elapsed(&c->started));
+	}
+	rig_unwatch(c->exec);
+	close(c->exec);
+	c->exec = -1;
+}
+
+/*
+   The exec pipe of the child running as (pid) `data` has
+   something to say (or was closed).
+ */
+static void
+piped(int fd, unsigned events, void *data)
 {
+	long c;
+
+	(void)fd; (void)events;
+	c = lookup(CONFIG, (pid_t)(intptr_t)data);
+	if (c >= 0)
+		execd(CONFIG, c);
+}
+
+static void spin(struct config *cfg, size_t i)
+{
+	static int scarce = 0; /* said so, about running out of fds? */
+	struct child *config = &cfg->child[i];
+	struct stats *st = &cfg->stats[i];
+	int fds[2];
+
+	/* out of file descriptors, we can still start it; we just
+	   won't hear about it if the exec fails (other than by it
+	   exiting 42), or how long the exec took. */
+	if (pipe(fds) != 0) {
+		if (errno != EMFILE && errno != ENFILE) {
+			fprintf(stderr, "pipe failed: %s\n", strerror(errno));
+			return;
+		}
+		if (!scarce++)
+			fprintf(stderr, "out of file descriptors; starting children without exec pipes\n");
+		fds[0] = fds[1] = -1;
+	} else {
+		scarce = 0;
+		fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+		fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &config->started);
 	config->pid = fork();
 
 	if (config->pid < 0) {
 		fprintf(stderr, "fork failed: %s\n", strerror(errno));
+		config->pid = 0;
+		if (fds[0] >= 0) {
+			close(fds[0]);
+			close(fds[1]);
+		}
 		return;
 	}
 
@@ -159,8 +600,18 @@ void spin(struct child *config)
 		/* in child process; set up for an exec! */
 		char *argv[2] = { NULL, NULL };
 		char *envp[1] = { NULL };
+		sigset_t none;
 		argv[0] = strrchr(config->command, '/') + 1;
 
+		/* signal masks survive exec; don't hand ours down */
+		sigemptyset(&none);
+		sigprocmask(SIG_SETMASK, &none, NULL);
+
+		/* everything this child spawns shares its session,
+		   which is how we tell whose orphans are whose. */
+		if (SUBREAPER)
+			setsid();
+
 		if (!freopen("/dev/null", "r", stdin)) {
 			fprintf(stderr, PROGRAM ": failed to redirect /dev/null into stdin\n");
 			fclose(stdin);
@@ -174,79 +625,823 @@ void spin(struct child *config)
 			fclose(stderr);
 		}
 
+		rig_fewerfds();
 		execve(config->command, argv, envp);
 		/* uh-oh, exec failed (bad binary? non-executable?
 		   who knows!), and we can't error because we just
-		   redirected standard error to /dev/null. -_- */
+		   redirected standard error to /dev/null.  The exec
+		   pipe is our only way of telling init about it. */
+		if (fds[1] >= 0 && write(fds[1], &errno, sizeof(errno)) < 0) {
+			/* nothing more we can do */
+		}
 		exit(42);
 
 	} else {
+		rig_trace(spawn, config->pid, 0);
+		if (fds[1] >= 0)
+			close(fds[1]);
+		config->exec = fds[0];
+		if (config->exec >= 0 && rig_watch(config->exec, EPOLLIN, piped, (void *)(intptr_t)config->pid) != 0) {
+			/* we'll still pick it up when the child exits */
+			fprintf(stderr, "failed to watch exec pipe: %s\n", strerror(errno));
+		}
+
+		roll(st, minute(NULL));
+		if (st->starts++ > 0)
+			st->restarts[0]++;
+
+		track(cfg, i);
+		if (SUBREAPER && adopt(cfg, config->pid, i) != 0)
+			fprintf(stderr, "out of memory; not tracking descendants of pid %d\n", config->pid);
 		fprintf(stderr, "pid %d `%s`\n", config->pid, config->command);
 	}
 }
 
-static struct child *CONFIG;
 
-void reaper(int sig, siginfo_t *info, void *_)
+/*
+   Forget about the sessions that have nobody left in them.
+
+   Reaping stays O(1) per process: all the reaper checks is
+   whether the session's own process group (the one its leader
+   started, with the same ID) is empty, with kill(-sid, 0).
+   Members can move out into groups of their own (setpgid())
+   though, so an empty group only makes the session a suspect.
+   Every so often (no more than once every SWEEP_NS), we make
+   one pass through /proc, to see which of the sessions we know
+   about still have anyone in them, and disown the rest.  That
+   pass is shared by everything reaped in the meantime.
+
+   Sessions whose leader is one of our children are always
+   kept, since it may not have gotten as far as setsid() yet.
+ */
+#define SWEEP_NS 1000000000LL
+
+static int SUSPECT;     /* might a session have emptied out? */
+static long long SWEPT; /* last time we looked (rig_now())   */
+
+static void sweep(struct config *cfg)
 {
-	struct child *chain = CONFIG;
-	while (chain) {
-		if (chain->pid == info->si_pid) {
-			int rc;
-			waitpid(chain->pid, &rc, 0);
-			chain->pid = 0;
-			break;
+	struct dirent *e;
+	pid_t pid, sid, *dead;
+	size_t s, n;
+	long long now;
+	DIR *d;
+
+	if (!SUSPECT)
+		return;
+	now = rig_now();
+	if (now - SWEPT < SWEEP_NS)
+		return;
+	SWEPT = now;
+
+	d = opendir("/proc");
+	if (!d)
+		return;
+	for (s = 0; s < cfg->ssize; s++)
+		cfg->sessions[s].live = 0;
+	while ((e = readdir(d)) != NULL) {
+		pid = atoi(e->d_name);
+		sid = pid > 0 ? getsid(pid) : -1;
+		if (sid <= 0)
+			continue;
+		for (s = sslot(cfg, sid); cfg->sessions[s].sid; s = sprobe(cfg, s))
+			if (cfg->sessions[s].sid == sid) {
+				cfg->sessions[s].live = 1;
+				break;
+			}
+	}
+	closedir(d);
+
+	/* disown() shuffles the table, so list them all first */
+	dead = calloc(cfg->nsessions + 1, sizeof(pid_t));
+	if (!dead)
+		return;
+	for (n = 0, s = 0; s < cfg->ssize; s++)
+		if (cfg->sessions[s].sid && !cfg->sessions[s].live
+		 && lookup(cfg, cfg->sessions[s].sid) < 0)
+			dead[n++] = cfg->sessions[s].sid;
+	while (n > 0)
+		disown(cfg, dead[--n]);
+	free(dead);
+	SUSPECT = 0;
+}
+
+/*
+   Reap every child process that has exited, whether we
+   spawned it from the inittab or not (orphans get handed to
+   us, and dropped inittab entries are no longer in CONFIG).
+
+   Orphans are peeked at before they are reaped, while their
+   session ID can still be looked up, so that we can work out
+   which inittab entry they came from.  Once a session has no
+   processes left in it, we stop tracking it (see sweep()).
+
+   Returns 0 once we have no child processes left at all,
+   and 1 if there are still some running.
+ */
+static int reaper(void)
+{
+	siginfo_t info;
+	pid_t pid, sid;
+	long i;
+	int rc;
+
+	for (;;) {
+		info.si_pid = 0;
+		rc = waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT);
+		if (rc < 0 && errno == ECHILD)
+			return 0;
+		if (rc < 0 || info.si_pid == 0) {
+			sweep(CONFIG);
+			return 1;
+		}
+
+		pid = info.si_pid;
+		i = forget(CONFIG, pid);
+		if (i >= 0) {
+			sid = pid;
+			waitpid(pid, &rc, 0);
+			rig_trace(exit, pid, rc);
+			execd(CONFIG, i);
+			CONFIG->stats[i].exits++;
+			observe(&CONFIG->stats[i].uptime, UPTIME_LE, elapsed(&CONFIG->child[i].started));
+			CONFIG->child[i].pid = 0;
+
+		} else {
+			sid = getsid(pid);
+			waitpid(pid, &rc, 0);
+			rig_trace(exit, pid, rc);
+			i = sid > 0 ? descent(CONFIG, sid) : -1;
+			if (i >= 0) CONFIG->stats[i].orphans++;
+			else        ORPHANS++;
 		}
-		chain = chain->next; /* ooh! linked list! */
+
+		if (i >= 0 && descent(CONFIG, sid) >= 0 && kill(-sid, 0) != 0 && errno == ESRCH)
+			SUSPECT = 1;
+	}
+}
+
+/*
+   Send `sig` to the child running as `pid`, and (with -s)
+   everything else in its session.  If it hasn't gotten around
+   to calling setsid() yet, there is no session, and only it
+   gets `sig`.
+ */
+static void
+signal_tree(pid_t pid, int sig)
+{
+	if (!SUBREAPER || kill(-pid, sig) != 0)
+		kill(pid, sig);
+}
+
+static unsigned long
+hash(const char *s)
+{
+	unsigned long h = 5381;
+	while (*s)
+		h = h * 33 ^ (unsigned char)*s++;
+	return h;
+}
+
+/*
+   Re-read the inittab at `path`, and swap it in for CONFIG.
+
+   Entries present in both the old and new configurations
+   carry their PID (and their metrics) over, so that they keep
+   running.  Old entries with no counterpart in the new inittab
+   are sent a SIGTERM (and will be reaped like any other orphan).
+   Duplicate commands are matched up one-for-one.
+
+   If the new inittab is bad, the current configuration is
+   kept as-is.  Returns 0 on success, -1 on failure.
+ */
+static int reconfigure(const char *path)
+{
+	struct config *fresh;
+	struct child *c;
+	char *command;
+	size_t *index, size, i, j;
+	pid_t sid;
+
+	fresh = configure(path);
+	if (!fresh) {
+		fprintf(stderr, "%s: keeping current configuration\n", path);
+		return -1;
+	}
+
+	/* index the running configuration by command, in an
+	   open-addressed hash table at most half full, so that
+	   the diff is linear in the size of the two inittabs. */
+	size = CONFIG->size;
+	index = calloc(size, sizeof(size_t));
+	if (!index) {
+		fprintf(stderr, "%s: out of memory; keeping current configuration\n", path);
+		release(fresh);
+		return -1;
+	}
+	for (j = 0; j < CONFIG->n; j++) {
+		CONFIG->child[j].claimed = 0;
+		for (i = hash(CONFIG->child[j].command) & (size - 1); index[i]; i = (i + 1) & (size - 1))
+			;
+		index[i] = j + 1;
+	}
+
+	for (j = 0; j < fresh->n; j++) {
+		for (i = hash(fresh->child[j].command) & (size - 1); index[i]; i = (i + 1) & (size - 1)) {
+			c = &CONFIG->child[index[i] - 1];
+			if (!c->claimed && eq(c->command, fresh->child[j].command)) {
+				c->claimed = j + 1;
+				command = fresh->child[j].command;
+				fresh->child[j] = *c;
+				fresh->child[j].command = command;
+				fresh->stats[j] = CONFIG->stats[index[i] - 1];
+				if (c->pid > 0)
+					track(fresh, j);
+				break;
+			}
+		}
+	}
+	free(index);
+
+	/* sessions follow their children into the new config;
+	   those whose children were dropped get terminated. */
+	for (i = 0; i < CONFIG->ssize; i++) {
+		sid = CONFIG->sessions[i].sid;
+		if (!sid)
+			continue;
+		c = &CONFIG->child[CONFIG->sessions[i].child];
+		if (c->claimed) {
+			if (adopt(fresh, sid, c->claimed - 1) != 0)
+				fprintf(stderr, "out of memory; not tracking session %d\n", sid);
+		} else if (sid != c->pid) {
+			kill(-sid, SIGTERM);
+		}
+	}
+
+	for (j = 0; j < CONFIG->n; j++) {
+		c = &CONFIG->child[j];
+		if (!c->claimed && c->pid > 0) {
+			fprintf(stderr, "stopping pid %d `%s`\n", c->pid, c->command);
+			signal_tree(c->pid, SIGTERM);
+			if (c->exec >= 0) {
+				rig_unwatch(c->exec);
+				close(c->exec);
+			}
+		}
+	}
+
+	release(CONFIG);
+	CONFIG = fresh;
+	return 0;
+}
+
+/*
+   Print a label value, escaped per the exposition format.
+ */
+static void
+label(FILE *io, const char *v)
+{
+	for (; *v; v++) {
+		if (*v == '\\' || *v == '"')
+			fputc('\\', io);
+		fputc(*v, io);
+	}
+}
+
+static void
+histogram(FILE *io, const char *name, const char *command,
+          const struct histogram *h, const double *le)
+{
+	unsigned long n;
+	int i;
+
+	for (n = 0, i = 0; i <= NBUCKETS; i++) {
+		n += h->bucket[i];
+		fprintf(io, "%s_bucket{command=\"", name);
+		label(io, command);
+		if (i < NBUCKETS) fprintf(io, "\",le=\"%g\"} %lu\n", le[i], n);
+		else              fprintf(io, "\",le=\"+Inf\"} %lu\n", n);
+	}
+	fprintf(io, "%s_sum{command=\"", name);
+	label(io, command);
+	fprintf(io, "\"} %.6f\n", h->sum);
+	fprintf(io, "%s_count{command=\"", name);
+	label(io, command);
+	fprintf(io, "\"} %lu\n", h->count);
+}
+
+#define COUNTER(io,name,command,fmt,v) do { \
+	fprintf((io), name "{command=\""); \
+	label((io), (command)); \
+	fprintf((io), "\"} " fmt "\n", (v)); \
+} while (0)
+
+/*
+   Write out all of our metrics, in the Prometheus text format.
+ */
+static void
+metrics(FILE *io)
+{
+	struct stats *st;
+	unsigned long now;
+	double frac;
+	size_t i;
+
+	now = minute(&frac);
+	for (i = 0; i < CONFIG->n; i++)
+		roll(&CONFIG->stats[i], now);
+
+	fprintf(io, "# HELP init_children Number of commands in the inittab.\n"
+	            "# TYPE init_children gauge\n"
+	            "init_children %lu\n", (unsigned long)CONFIG->n);
+	fprintf(io, "# HELP init_sessions Number of sessions being tracked.\n"
+	            "# TYPE init_sessions gauge\n"
+	            "init_sessions %lu\n", (unsigned long)CONFIG->nsessions);
+	fprintf(io, "# HELP init_orphans_total Orphans reaped that weren't from any inittab entry.\n"
+	            "# TYPE init_orphans_total counter\n"
+	            "init_orphans_total %lu\n", ORPHANS);
+
+#define EACH(help, type, name, fmt, expr) \
+	fprintf(io, "# HELP " name " " help "\n# TYPE " name " " type "\n"); \
+	for (i = 0; i < CONFIG->n; i++) { \
+		st = &CONFIG->stats[i]; \
+		COUNTER(io, name, CONFIG->child[i].command, fmt, (expr)); \
+	}
+
+	EACH("Whether the child is currently running.", "gauge",
+	     "init_child_up", "%d", CONFIG->child[i].pid > 0 ? 1 : 0);
+	EACH("Times the child has been started.", "counter",
+	     "init_child_starts_total", "%lu", st->starts);
+	EACH("Times the child has been restarted.", "counter",
+	     "init_child_restarts_total", "%lu", st->starts ? st->starts - 1 : 0);
+	EACH("Times the child failed to exec.", "counter",
+	     "init_child_exec_failures_total", "%lu", st->failures);
+	EACH("Times the child has exited.", "counter",
+	     "init_child_exits_total", "%lu", st->exits);
+	EACH("Orphaned descendants of the child that were reaped.", "counter",
+	     "init_child_orphans_total", "%lu", st->orphans);
+	EACH("Restarts over the last minute (sliding window).", "gauge",
+	     "init_child_restarts_per_minute", "%.2f", st->restarts[1] * (1 - frac) + st->restarts[0]);
+#undef EACH
+
+	fprintf(io, "# HELP init_child_exec_seconds Time from fork to exec.\n"
+	            "# TYPE init_child_exec_seconds histogram\n");
+	for (i = 0; i < CONFIG->n; i++)
+		histogram(io, "init_child_exec_seconds", CONFIG->child[i].command,
+		          &CONFIG->stats[i].exec, EXEC_LE);
+
+	fprintf(io, "# HELP init_child_uptime_seconds How long the child ran before exiting.\n"
+	            "# TYPE init_child_uptime_seconds histogram\n");
+	for (i = 0; i < CONFIG->n; i++)
+		histogram(io, "init_child_uptime_seconds", CONFIG->child[i].command,
+		          &CONFIG->stats[i].uptime, UPTIME_LE);
+}
+
+/*
+   Metrics replies.  Each one is rendered in full when the
+   scraper connects, and then sent without ever blocking: as
+   much as the socket will take right away, and the rest from
+   the main loop, whenever it has room.  We are PID 1, after
+   all, and have other things to do.  A scraper gets SCRAPE_NS
+   to read the whole thing (checked every SCRAPE_NS / 4, by the
+   SCRAPER timer), and only SCRAPES of them get served at once.
+ */
+#define SCRAPES   8
+#define SCRAPE_NS 1000000000LL
+
+static struct reply {
+	int fd;
+	char *buf;           /* NULL = not in use */
+	size_t len, off;
+	long long deadline;  /* rig_now() */
+} REPLIES[SCRAPES];
+static int SCRAPER = -1; /* timer, for hanging up on slowpokes */
+static int NREPLIES;
+
+static void
+hangup(struct reply *r)
+{
+	rig_unwatch(r->fd);
+	close(r->fd);
+	free(r->buf);
+	r->buf = NULL;
+	if (--NREPLIES == 0)
+		rig_arm(SCRAPER, -1, 0, 0);
+}
+
+/*
+   Send as much of reply `data` as the socket will take,
+   hanging up once it's all gone (or the scraper has).
+ */
+static void
+sending(int fd, unsigned events, void *data)
+{
+	struct reply *r = data;
+	ssize_t n;
+
+	(void)events;
+	while (r->off < r->len) {
+		n = write(fd, r->buf + r->off, r->len - r->off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (n <= 0)
+			break;
+		r->off += n;
+	}
+	hangup(r);
+}
+
+static void
+expired(int fd, unsigned events, void *data)
+{
+	long long now;
+	size_t i;
+
+	(void)events; (void)data;
+	if (rig_ticks(fd) <= 0)
+		return;
+	now = rig_now();
+	for (i = 0; i < SCRAPES; i++)
+		if (REPLIES[i].buf && REPLIES[i].deadline <= now)
+			hangup(&REPLIES[i]);
+}
+
+/*
+   Render the metrics for whoever just connected, and start
+   sending them.  If we're already busy with SCRAPES others,
+   they get hung up on (and can try again).
+ */
+static void
+scrape(void)
+{
+	struct reply *r;
+	FILE *io;
+	size_t i;
+	int fd;
+
+	fd = accept(METRICS, NULL, NULL);
+	if (fd < 0)
+		return;
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	for (i = 0; i < SCRAPES && REPLIES[i].buf; i++)
+		;
+	if (i == SCRAPES) {
+		close(fd);
+		return;
+	}
+	r = &REPLIES[i];
+
+	io = open_memstream(&r->buf, &r->len);
+	if (!io) {
+		close(fd);
+		return;
+	}
+	metrics(io);
+	fclose(io);
+
+	r->fd = fd;
+	r->off = 0;
+	r->deadline = rig_now() + SCRAPE_NS;
+	if (rig_watch(fd, EPOLLOUT, sending, r) != 0) {
+		close(fd);
+		free(r->buf);
+		r->buf = NULL;
+		return;
+	}
+	if (NREPLIES++ == 0)
+		rig_arm(SCRAPER, SCRAPE_NS / 4, SCRAPE_NS / 4, 0);
+	sending(fd, EPOLLOUT, r);
+}
+
+static int
+listener(const char *path)
+{
+	struct sockaddr_un sa;
+	int fd;
+
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		fprintf(stderr, PROGRAM ": metrics socket path '%s' is too long\n", path);
+		return -1;
 	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		goto fail;
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0
+	 || listen(fd, 16) != 0)
+		goto fail;
+	return fd;
+
+fail:
+	fprintf(stderr, PROGRAM ": failed to listen on %s: %s\n", path, strerror(errno));
+	if (fd >= 0)
+		close(fd);
+	return -1;
 }
 
 #define PROGRAM "init"
 
 #define INITTAB "/etc/inittab"
+#define GRACE   10
+
+#define RELOAD 1
+#define STOP   2
+
+/*
+   How long until `deadline`, in milliseconds (for epoll),
+   rounded up so that we don't wake up just shy of it.
+ */
+static int
+msleft(const struct timespec *deadline)
+{
+	struct timespec now;
+	long ms;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+		return 0;
+
+	ms = (deadline->tv_sec - now.tv_sec) * 1000
+	   + (deadline->tv_nsec - now.tv_nsec + 999999) / 1000000;
+	return ms < 0 ? 0 : (int)ms;
+}
+
+static int WHAT; /* RELOAD and / or STOP, as requested */
+
+static void
+signalled(int fd, unsigned events, void *data)
+{
+	int sig;
+
+	(void)events; (void)data;
+	while ((sig = rig_signal(fd)) != 0) {
+		if (sig == SIGHUP)
+			WHAT |= RELOAD;
+		if (sig == SIGTERM || sig == SIGINT)
+			WHAT |= STOP;
+	}
+	reaper();
+}
+
+static void
+scraped(int fd, unsigned events, void *data)
+{
+	(void)fd; (void)events; (void)data;
+	scrape();
+}
+
+/*
+   Wait (until `deadline`, at the latest) for something to
+   happen, and deal with it.  Exits are reaped and metrics are
+   scraped right here; SIGHUP and SIGTERM / SIGINT are left to
+   the caller, by returning RELOAD and / or STOP.  Returns 0 if
+   the deadline passed, and -1 if epoll failed.
+ */
+static int
+wait_for(const struct timespec *deadline)
+{
+	WHAT = 0;
+	if (rig_dispatch(msleft(deadline)) < 0) {
+		fprintf(stderr, "epoll_wait failed: %s\n", strerror(errno));
+		return -1;
+	}
+	return WHAT;
+}
+
+/*
+   Send `sig` to every orphan that has been handed to us, per
+   /proc/self/task/<pid>/children, in case they have wandered
+   out of the sessions we track.  (Subreapers only.)
+ */
+static void
+strays(int sig)
+{
+	char path[64];
+	long pid;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/self/task/%d/children", (int)getpid());
+	f = fopen(path, "r");
+	if (!f)
+		return;
+	while (fscanf(f, "%ld", &pid) == 1)
+		kill((pid_t)pid, sig);
+	fclose(f);
+}
+
+/*
+   Send `sig` to every child process.  As PID 1, that means
+   every process in our namespace, whether we know it or not.
+   Otherwise, it means every child we have started (and, as a
+   subreaper, their sessions, and anything else that got
+   reparented to us).
+ */
+static void
+killall(int sig)
+{
+	size_t i;
+
+	if (getpid() == 1) {
+		kill(-1, sig);
+		return;
+	}
+	for (i = 0; i < CONFIG->n; i++)
+		if (CONFIG->child[i].pid > 0)
+			signal_tree(CONFIG->child[i].pid, sig);
+	for (i = 0; i < CONFIG->ssize; i++)
+		if (CONFIG->sessions[i].sid && lookup(CONFIG, CONFIG->sessions[i].sid) < 0)
+			kill(-CONFIG->sessions[i].sid, sig);
+	if (SUBREAPER)
+		strays(sig);
+}
+
+/*
+   Shut everything down, and exit.
+
+   All children are sent a SIGTERM at once, so that they can
+   clean up in parallel, and we wait for them to exit, for up
+   to `grace` seconds.  A second SIGTERM or SIGINT, or running
+   out of time, gets all the stragglers SIGKILLed.
+ */
+static void
+halt(int grace)
+{
+	struct timespec deadline;
+	int rc, left;
+
+	fprintf(stderr, "shutting down; waiting up to %ds for children to exit\n", grace);
+	killall(SIGTERM);
+	killall(SIGCONT);
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += grace;
+
+	while ((left = reaper()) != 0 && msleft(&deadline) > 0) {
+		rc = wait_for(&deadline);
+		if (rc < 0)
+			break;
+		if (rc & STOP)
+			deadline.tv_sec = 0;
+	}
+
+	if (!left)
+		exit(EXIT_OK);
+
+	/* as a subreaper, more orphans may turn up as their
+	   parents die, so keep killing until nothing is left. */
+	fprintf(stderr, "some children are still running; killing them\n");
+	do {
+		killall(SIGKILL);
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_nsec += 100000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		wait_for(&deadline);
+	} while (reaper());
+	exit(EXIT_RUNTIME);
+}
+
+static void
+usage(int rc)
+{
+	fprintf(stderr, "USAGE: " PROGRAM " [-s] [-t SECONDS] [-m /path/to/socket] [" INITTAB "]\n");
+	exit(rc);
+}
 
 int main(int argc, char **argv)
 {
-	struct sigaction sa;
-	struct timespec nap;
-	int rc;
+	const char *inittab, *socket;
+	struct timespec nap, deadline;
+	sigset_t mask;
+	int rc, sfd, grace;
+	char *end;
 
-	if (argc == 1) {
-		CONFIG = configure(INITTAB);
+	grace = GRACE;
+	inittab = INITTAB;
+	socket = NULL;
 
-	} else if (argc == 2) {
-		if (eq(argv[1], "-v")) show_version(PROGRAM);
-		CONFIG = configure(argv[1]);
+	argc--; argv++;
+	if (argc >= 1 && eq(argv[0], "-v")) show_version(PROGRAM);
+	while (argc >= 1 && argv[0][0] == '-') {
+		if (eq(argv[0], "-h")) usage(EXIT_OK);
+		if (eq(argv[0], "-s")) {
+			SUBREAPER = 1;
+			argc--; argv++;
+			continue;
+		}
+		if (argc < 2) usage(EXIT_IMPROPER);
 
-	} else {
-		fprintf(stderr, "USAGE: " PROGRAM " [" INITTAB "]\n");
-		exit(EXIT_IMPROPER);
+		if (eq(argv[0], "-t")) {
+			grace = (int)strtol(argv[1], &end, 10);
+			if (*end || end == argv[1] || grace < 0) {
+				fprintf(stderr, PROGRAM ": invalid shutdown timeout '%s'\n", argv[1]);
+				exit(EXIT_IMPROPER);
+			}
+
+		} else if (eq(argv[0], "-m")) {
+			socket = argv[1];
+
+		} else {
+			usage(EXIT_IMPROPER);
+		}
+		argc -= 2; argv += 2;
 	}
+	if (argc == 1) {
+		inittab = argv[0];
 
+	} else if (argc != 0) {
+		usage(EXIT_IMPROPER);
+	}
 
+	CONFIG = configure(inittab);
 	if (!CONFIG)
 		exit(EXIT_IMPROPER);
 
-	sa.sa_sigaction = reaper;
-	sa.sa_flags = SA_NOCLDSTOP | SA_SIGINFO;
-	rc = sigaction(SIGCHLD, &sa, NULL);
-	if (rc != 0) {
-		fprintf(stderr, "failed to set up SIGCLD handler: %s\n", strerror(errno));
+	/* an exec pipe per child starting up adds up, with
+	   thousands of them; children get the usual limit
+	   back, though, as they exec (see spin()) */
+	rig_morefds();
+
+	if (SUBREAPER && prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0) != 0) {
+		fprintf(stderr, "failed to become a subreaper: %s\n", strerror(errno));
 		exit(EXIT_RUNTIME);
 	}
 
+	/* signals get handled synchronously, from the main loop,
+	   so that reconfiguring (which allocates) is safe. */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGPIPE);
+	sfd = rig_signalfd(&mask);
+	if (sfd < 0) {
+		fprintf(stderr, "failed to set up signal handling: %s\n", strerror(errno));
+		exit(EXIT_RUNTIME);
+	}
+	if (rig_watch(sfd, EPOLLIN, signalled, NULL) != 0) {
+		fprintf(stderr, "failed to set up event loop: %s\n", strerror(errno));
+		exit(EXIT_RUNTIME);
+	}
+
+	if (socket) {
+		METRICS = listener(socket);
+		if (METRICS < 0 || rig_watch(METRICS, EPOLLIN, scraped, NULL) != 0)
+			exit(EXIT_RUNTIME);
+		SCRAPER = rig_timer(CLOCK_MONOTONIC);
+		if (SCRAPER < 0 || rig_watch(SCRAPER, EPOLLIN, expired, NULL) != 0) {
+			fprintf(stderr, "failed to set up metrics timer: %s\n", strerror(errno));
+			exit(EXIT_RUNTIME);
+		}
+	}
+
 	nap.tv_sec = 0;
 	nap.tv_nsec = 100000000;
 	for (;;) {
-		struct child *tmp;
-		tmp = CONFIG;
-		while (tmp) {
-			if (tmp->pid == 0 || kill(tmp->pid, 0) != 0)
-				spin(tmp);
-			tmp = tmp->next;
+		size_t i;
+		for (i = 0; i < CONFIG->n; i++) {
+			if (CONFIG->child[i].pid == 0)
+				spin(CONFIG, i);
 		}
 
-		while (nanosleep(&nap, NULL) == -1);
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec  += nap.tv_sec;
+		deadline.tv_nsec += nap.tv_nsec;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		do {
+			rc = wait_for(&deadline);
+		} while (rc == 0 && msleft(&deadline) > 0);
+		sweep(CONFIG); /* in case nothing's been reaped lately */
+
+		if (rc > 0 && (rc & STOP))
+			halt(grace);
+
+		if (rc > 0 && (rc & RELOAD)) {
+			fprintf(stderr, "reloading %s\n", inittab);
+			if (reconfigure(inittab) == 0) {
+				/* start new entries without delay */
+				nap.tv_sec = 0;
+				nap.tv_nsec = 100000000;
+				continue;
+			}
+		}
 
 		if (nap.tv_sec == 0) {
 			nap.tv_nsec += 100000000;
@@ -23,54 +23,409 @@
 
    locked - Execute a program while holding a filesystem lock
 
-   USAGE: locked lock-file path/to/command args...
+   USAGE: locked [-s] [-n | -w SECONDS] lock-file path/to/command args...
+          locked -c N [-n | -w SECONDS] lock-dir path/to/command args...
           locked -v
 
+   Takes out an exclusive lock on lock-file (creating it, if need be),
+   and then execs the command, which holds onto the lock until it exits.
+
+   Options:
+
+     -s          Take a shared lock instead.  Any number of shared lock
+                 holders can run at once, but not while anyone holds the
+                 exclusive lock (and vice versa).
+
+     -n          Don't wait; if the lock is already held, give up, and
+                 exit 3.
+
+     -w SECONDS  Wait at most SECONDS (which can be fractional) for the
+                 lock, and then give up, and exit 3.
+
+     -c N        Counting semaphore mode: let up to N commands run at
+                 once.  The lock-dir (created, if need be) holds N slot
+                 files (slot.0, slot.1, ...), a ticket counter, `queue',
+                 and a `wait.TICKET' file for each command waiting.
+                 Waiters get in line in ticket order (first come, first
+                 served), and each one only waits on the one just ahead
+                 of it, so that only one of them wakes up at a time.
+                 Only the one at the front checks the slots, and rather
+                 than retrying, it waits (via inotify) for someone to
+                 finish with theirs.  The slot we get is passed on to the
+                 command as $LOCKED_SLOT (0 to N-1), in case it needs
+                 some scratch space of its own.  Everybody sharing a
+                 lock-dir should use the same N.
+
+   If fd 3 is open, how long it took to get the lock is logged there.
+
  */
 
 #include "rig.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <limits.h>
+#include <dirent.h>
 
 #define PROGRAM "locked"
 
+/* for -n and -w: somebody else has the lock */
+#define EXIT_BUSY 3
+
+static volatile sig_atomic_t expired;
+static char waiting[PATH_MAX]; /* our wait.TICKET file, while in line */
+
 static void
 usage(int rc)
 {
-	fprintf(stderr, "USAGE: locked lock-file path/to/command args...\n");
+	fprintf(stderr, "USAGE: locked [-s] [-n | -w SECONDS] lock-file path/to/command args...\n"
+	                "       locked -c N [-n | -w SECONDS] lock-dir path/to/command args...\n");
 	exit(rc);
 }
 
-int main(int argc, char **argv)
+static void
+ding(int sig)
+{
+	(void)sig;
+	expired = 1;
+}
+
+/*
+   Have SIGALRM interrupt us (flock(), really) after `secs`.
+
+   The timer keeps going off, every 10ms, after the first time;
+   if the first one lands just before we get into flock(), the
+   next will still get us out.
+ */
+static void
+timeout(double secs)
+{
+	struct sigaction sa;
+	struct itimerval it;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = ding;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0; /* no SA_RESTART; that's the point */
+	sigaction(SIGALRM, &sa, NULL);
+
+	memset(&it, 0, sizeof(it));
+	it.it_value.tv_sec  = (time_t)secs;
+	it.it_value.tv_usec = (suseconds_t)((secs - (time_t)secs) * 1e6);
+	if (!it.it_value.tv_sec && !it.it_value.tv_usec)
+		it.it_value.tv_usec = 1;
+	it.it_interval.tv_usec = 10000;
+	setitimer(ITIMER_REAL, &it, NULL);
+}
+
+/*
+   Turn off the timeout() timer; interval timers survive exec,
+   and the command we run has no use for our SIGALRMs.
+ */
+static void
+disarm(void)
+{
+	struct itimerval it;
+
+	memset(&it, 0, sizeof(it));
+	setitimer(ITIMER_REAL, &it, NULL);
+	signal(SIGALRM, SIG_DFL);
+}
+
+static double
+since(const struct timespec *start)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec - start->tv_sec) + (ts.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void
+busy(const char *what, double wait)
+{
+	if (*waiting) unlink(waiting); /* out of line */
+	if (wait == 0) fprintf(stderr, PROGRAM ": '%s' is already locked\n", what);
+	else           fprintf(stderr, PROGRAM ": gave up waiting for '%s' after %gs\n", what, wait);
+	exit(EXIT_BUSY);
+}
+
+static void
+fail(const char *what, const char *path)
+{
+	fprintf(stderr, PROGRAM ": failed to %s '%s': %s (error %d)\n", what, path, strerror(errno), errno);
+	exit(EXIT_RUNTIME);
+}
+
+/*
+   Get in line for the slots in lock directory `dir`: take the
+   next ticket from the counter in `queue', and create (and
+   lock) our own `wait.TICKET' file, which we hold onto for as
+   long as we're in line.  Returns its descriptor, and leaves
+   its name in `mine`.
+ */
+static int
+enqueue(const char *dir, double wait, char *mine, size_t len)
 {
+	char path[PATH_MAX], buf[32];
+	unsigned long long ticket;
+	ssize_t nread;
+	int queue, fd;
+
+	if (snprintf(path, sizeof(path), "%s/queue", dir) >= (int)sizeof(path)) {
+		errno = ENAMETOOLONG;
+		fail("lock", dir);
+	}
+	queue = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (queue < 0)
+		fail("lock", path);
+	while (flock(queue, LOCK_EX) != 0) {
+		if (errno == EINTR && expired) busy(dir, wait);
+		if (errno != EINTR)
+			fail("lock", path);
+	}
+
+	/* the counter only ever gets longer, so no truncating */
+	nread = pread(queue, buf, sizeof(buf) - 1, 0);
+	buf[nread > 0 ? nread : 0] = '\0';
+	ticket = strtoull(buf, NULL, 10);
+	snprintf(buf, sizeof(buf), "%llu\n", ticket + 1);
+	if (pwrite(queue, buf, strlen(buf), 0) != (ssize_t)strlen(buf))
+		fail("update", path);
+
+	/* nobody can be waiting on this one yet; only tickets
+	   after ours do that, and we haven't handed any out */
+	snprintf(mine, len, "wait.%020llu", ticket);
+	snprintf(waiting, sizeof(waiting), "%s/%s", dir, mine);
+	fd = open(waiting, O_RDONLY | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0 || flock(fd, LOCK_EX) != 0)
+		fail("lock", waiting);
+
+	close(queue);
+	return fd;
+}
+
+/*
+   Wait until we're at the front of the line, i.e. until there
+   is nobody with an earlier ticket than `mine` still waiting.
+   We only ever wait on the one just ahead of us; when they're
+   done, they remove their wait file, and let go of it.  If one
+   is still there when we get the lock on it, whoever it was
+   gave up (or died), and we clean it up for them.
+ */
+static void
+await(const char *dir, const char *mine, double wait)
+{
+	char path[PATH_MAX], ahead[64];
+	struct dirent *e;
+	DIR *d;
 	int fd;
 
-	if (argc > 1 && argv[1][0] == '-') {
-		if (eq(argv[1], "-v")) show_version(PROGRAM);
-		if (eq(argv[1], "-h")) usage(EXIT_OK);
-		usage(EXIT_IMPROPER);
+	for (;;) {
+		d = opendir(dir);
+		if (!d)
+			fail("read lock directory", dir);
+		*ahead = '\0';
+		while ((e = readdir(d)) != NULL)
+			if (strlen(e->d_name) == strlen(mine) && strncmp(e->d_name, "wait.", 5) == 0
+			 && strcmp(e->d_name, mine) < 0 && strcmp(e->d_name, ahead) > 0)
+				strcpy(ahead, e->d_name);
+		closedir(d);
+		if (!*ahead)
+			return;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, ahead);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			if (errno == ENOENT) continue; /* just left */
+			fail("lock", path);
+		}
+		while (flock(fd, wait == 0 ? LOCK_SH | LOCK_NB : LOCK_SH) != 0) {
+			if (errno == EWOULDBLOCK && wait == 0) busy(dir, wait);
+			if (errno == EINTR && expired)         busy(dir, wait);
+			if (errno != EINTR)
+				fail("lock", path);
+		}
+		unlink(path);
+		close(fd);
 	}
-	if (argc < 3) usage(EXIT_IMPROPER);
+}
 
-	fd = open(argv[1], O_WRONLY | O_NDELAY | O_APPEND | O_CREAT, 0600);
-	if (fd < 0) {
-		fprintf(stderr, PROGRAM ": failed to lock '%s': %s (error %d)\n", argv[1], strerror(errno), errno);
+/*
+   Take one of the `n` slots in lock directory `dir`, waiting
+   (at most `wait` seconds, if that's positive, or not at all,
+   if it's zero) for one to free up.  Returns the index of the
+   slot, and leaves its (locked) file descriptor in `*fd`.
+ */
+static int
+semaphore(const char *dir, int n, double wait, int *fd)
+{
+	char path[PATH_MAX], events[4096], mine[64];
+	struct pollfd pfd;
+	int *slots, queue, i, got;
+
+	if (mkdir(dir, 0700) != 0 && errno != EEXIST)
+		fail("create lock directory", dir);
+
+	/* get in line */
+	queue = enqueue(dir, wait, mine, sizeof(mine));
+	await(dir, mine, wait);
+
+	/* we're at the front of the line; watch for slots being
+	   given up *before* we look at them, so we don't miss any */
+	pfd.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	pfd.events = POLLIN;
+	if (pfd.fd < 0 || inotify_add_watch(pfd.fd, dir, IN_CLOSE_WRITE) < 0)
+		fail("watch lock directory", dir);
+
+	slots = calloc(n, sizeof(int));
+	if (!slots) {
+		fprintf(stderr, PROGRAM ": failed to allocate memory\n");
 		exit(EXIT_RUNTIME);
 	}
+	for (i = 0; i < n; i++) {
+		snprintf(path, sizeof(path), "%s/slot.%d", dir, i);
+		slots[i] = open(path, O_WRONLY | O_NDELAY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+		if (slots[i] < 0)
+			fail("lock", path);
+	}
 
-	if (flock(fd, LOCK_EX) != 0) {
-		fprintf(stderr, PROGRAM ": failed to lock '%s': %s (error %d)\n", argv[1], strerror(errno), errno);
+	for (;;) {
+		for (got = 0; got < n; got++)
+			if (flock(slots[got], LOCK_EX | LOCK_NB) == 0)
+				break;
+		if (got < n)
+			break;
+		if (wait == 0)
+			busy(dir, wait);
+
+		/* wait for some slot holder to exit (and close it) */
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR && expired) busy(dir, wait);
+			if (errno != EINTR)
+				fail("watch lock directory", dir);
+		}
+		while (read(pfd.fd, events, sizeof(events)) > 0)
+			;
+	}
+
+	/* the command holds the slot until it exits */
+	fcntl(slots[got], F_SETFD, 0);
+	*fd = slots[got];
+
+	for (i = 0; i < n; i++)
+		if (i != got)
+			close(slots[i]);
+	free(slots);
+	close(pfd.fd);
+
+	/* next! */
+	unlink(waiting);
+	*waiting = '\0';
+	close(queue);
+	return got;
+}
+
+int main(int argc, char **argv)
+{
+	struct timespec start;
+	double wait;
+	char *end, slot[16];
+	int fd, op, opt, debug, n, i;
+
+	op = LOCK_EX;
+	wait = -1;
+	n = 0;
+
+	if (argc > 1 && eq(argv[1], "-v")) show_version(PROGRAM);
+	while ((opt = getopt(argc, argv, "+hsnw:c:")) != -1) {
+		switch (opt) {
+		case 'h': usage(EXIT_OK);
+		case 's': op = LOCK_SH; break;
+		case 'n': wait = 0; break;
+		case 'c':
+			n = (int)strtol(optarg, &end, 10);
+			if (*end || end == optarg || n < 1 || n > 1024) {
+				fprintf(stderr, PROGRAM ": invalid slot count '%s' for -c (must be 1-1024)\n", optarg);
+				exit(EXIT_IMPROPER);
+			}
+			break;
+		case 'w':
+			wait = strtod(optarg, &end);
+			if (*end || end == optarg || wait < 0) {
+				fprintf(stderr, PROGRAM ": invalid timeout '%s' for -w\n", optarg);
+				exit(EXIT_IMPROPER);
+			}
+			break;
+		default:  usage(EXIT_IMPROPER);
+		}
+	}
+	argc -= optind - 1; argv += optind - 1;
+	if (argc < 3) usage(EXIT_IMPROPER);
+	if (n && op == LOCK_SH) usage(EXIT_IMPROPER);
+
+	debug = fcntl(3, F_GETFD) >= 0;
+
+	if (n) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (wait > 0)
+			timeout(wait);
+		i = semaphore(argv[1], n, wait, &fd);
+		if (wait > 0)
+			disarm();
+
+		rig_trace(lock, since(&start) * 1e9, i);
+		snprintf(slot, sizeof(slot), "%d", i);
+		if (setenv("LOCKED_SLOT", slot, 1) != 0)
+			fail("set $LOCKED_SLOT for", argv[2]);
+		if (debug)
+			dprintf(3, PROGRAM ": took slot %d of %d in '%s' after %.6fs\n",
+				i, n, argv[1], since(&start));
+
+		rig_exec(&argv[2]);
+		fprintf(stderr, PROGRAM ": failed to exec '%s': %s (error %d)\n", argv[2], strerror(errno), errno);
 		exit(EXIT_RUNTIME);
 	}
 
-	execvp(argv[2], &argv[2]);
+	/* readers may not have write access; they don't need it */
+	if (op == LOCK_SH) fd = open(argv[1], O_RDONLY | O_NDELAY | O_CREAT, 0600);
+	else               fd = open(argv[1], O_WRONLY | O_NDELAY | O_APPEND | O_CREAT, 0600);
+	if (fd < 0)
+		fail("lock", argv[1]);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (wait == 0)
+		op |= LOCK_NB;
+	else if (wait > 0)
+		timeout(wait);
+
+	while (flock(fd, op) != 0) {
+		if (errno == EWOULDBLOCK && (op & LOCK_NB)) busy(argv[1], wait);
+		if (errno == EINTR && expired)              busy(argv[1], wait);
+		if (errno != EINTR)
+			fail("lock", argv[1]);
+	}
+	if (wait > 0)
+		disarm();
+	rig_trace(lock, since(&start) * 1e9, -1);
+
+	if (debug)
+		dprintf(3, PROGRAM ": took out %s lock on '%s' after %.6fs\n",
+			(op & LOCK_SH) ? "shared" : "exclusive", argv[1], since(&start));
+
+	rig_exec(&argv[2]);
 	fprintf(stderr, PROGRAM ": failed to exec '%s': %s (error %d)\n", argv[2], strerror(errno), errno);
 	exit(EXIT_RUNTIME);
 }
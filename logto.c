@@ -23,9 +23,18 @@
 
    logto - Timestamp lines read from standard input, and write them to disk
 
-   USAGE: ./some/program | logto /the/log/file
+   USAGE: ./some/program | logto [-s SIZE] /the/log/file
           logto -v
 
+   Each line gets the time it was read (seconds.milliseconds since
+   the epoch) written in front of it.  Lines longer than a single
+   read are written out as they come in, stamped only once.
+
+   With -s, the log file is rotated once it has grown past SIZE
+   bytes (which can end in k, m or g): it is renamed to FILE.1
+   (replacing any FILE.1 already there), and a fresh FILE is
+   started.  Rotation only ever happens between lines.
+
  */
 
 #include "rig.h"
@@ -36,6 +45,7 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/stat.h>
 
 #define PROGRAM "logto"
 
@@ -55,39 +65,111 @@ again:
 	goto again;
 }
 
-int main(int argc, char **argv)
+static void
+usage(int rc)
 {
-	int rc, mid;
-	char *a, *b, buf[MAX_LINE], ts[16];
-	struct timeval t;
-	ssize_t nread;
+	fprintf(stderr, "USAGE: " PROGRAM " [-s SIZE] /path/to/log/file\n");
+	exit(rc);
+}
 
-	if (argc != 2) {
-		fprintf(stderr, "USAGE: log /path/to/log/file\n");
-		exit(EXIT_IMPROPER);
+/*
+   Parse a size, like 4096, 512k or 10m; returns 0 if it isn't one.
+ */
+static unsigned long long
+size(const char *s)
+{
+	unsigned long long n;
+	char *end;
+
+	if (*s < '0' || *s > '9') return 0;
+	n = strtoull(s, &end, 10);
+	switch (*end) {
+	case 'g': case 'G': n *= 1024;
+	/* fall through */
+	case 'm': case 'M': n *= 1024;
+	/* fall through */
+	case 'k': case 'K': n *= 1024; end++;
+	/* fall through */
+	case '\0': break;
+	default: return 0;
 	}
+	return *end ? 0 : n;
+}
 
-	if (argv[1][0] == '-') {
-		if (eq(argv[1], "-v")) show_version(PROGRAM);
-		fprintf(stderr, "USAGE: log /path/to/log/file\n");
-		exit(EXIT_IMPROPER);
-	}
+/*
+   (Re-)open `file` as our standard output, for appending, and
+   return how big it already is.
+ */
+static unsigned long long
+reopen(const char *file)
+{
+	struct stat st;
 
-	if (!freopen(argv[1], "a", stdout)) {
-		fprintf(stderr, "%s: %s (error %d)\n", argv[1], strerror(errno), errno);
+	if (!freopen(file, "a", stdout) || fstat(1, &st) != 0) {
+		fprintf(stderr, PROGRAM ": %s: %s (error %d)\n", file, strerror(errno), errno);
 		exit(EXIT_RUNTIME);
 	}
+	return st.st_size;
+}
+
+/*
+   Move `file` out of the way (to FILE.1), and start a new one.
+ */
+static unsigned long long
+rotate(const char *file, unsigned long long written)
+{
+	static int failed = 0; /* only complain once (in a row) */
+	char old[8192];
+
+	if (snprintf(old, sizeof(old), "%s.1", file) >= (int)sizeof(old)
+	 || rename(file, old) != 0) {
+		if (!failed++)
+			fprintf(stderr, PROGRAM ": failed to rotate %s: %s (error %d); will keep trying\n", file, strerror(errno), errno);
+		return written;
+	}
+	failed = 0;
+	rig_trace(rotate, written, 0);
+	return reopen(file);
+}
+
+int main(int argc, char **argv)
+{
+	int rc, mid, traced;
+	char *a, *b, *end, buf[MAX_LINE], ts[16];
+	unsigned long long limit, written;
+	struct timeval t;
+	ssize_t nread;
+	long long started;
+	const char *file;
+
+	limit = 0;
+	started = 0;
+	if (argc == 2 && eq(argv[1], "-v")) show_version(PROGRAM);
+	if (argc == 2 && eq(argv[1], "-h")) usage(EXIT_OK);
+	if (argc == 4 && eq(argv[1], "-s")) {
+		limit = size(argv[2]);
+		if (!limit) {
+			fprintf(stderr, PROGRAM ": invalid size '%s'\n", argv[2]);
+			usage(EXIT_IMPROPER);
+		}
+		argc -= 2; argv += 2;
+	}
+	if (argc != 2 || argv[1][0] == '-') usage(EXIT_IMPROPER);
+
+	file = argv[1];
+	written = reopen(file);
 
 	memset(ts, ' ', 16);
 	mid = 0;
 	for (;;) {
-		nread = read(0, buf, MAX_LINE - 1);
+		nread = read(0, buf, MAX_LINE);
 		if (nread == 0) break;
 		if (nread < 0) {
+			if (errno == EINTR) continue;
 			fprintf(stderr, "failed to read from stdin: %s (error %d)\n", strerror(errno), errno);
 			exit(EXIT_RUNTIME);
 		}
-		buf[nread] = '\0';
+		end = buf + nread;
 
 		rc = gettimeofday(&t, NULL);
 		if (rc < 0) {
@@ -113,17 +195,24 @@ int main(int argc, char **argv)
 		ts[12] = '0' + t.tv_usec % 10; t.tv_usec /= 10;
 		ts[11] = '0' + t.tv_usec % 10;
 
-		for (a = &buf[0]; *a; ) {
-			b = strchr(a, '\n');
-			if (!b) {
-				mid = 1;
-				break;
-			}
+		traced = rig_traced();
+		if (traced) started = rig_now();
+		for (a = &buf[0]; a < end; a = b) {
+			b = memchr(a, '\n', end - a);
+			b = b ? b + 1 : end;
 
-			if (!mid) writeall(1, ts, 16);
-			writeall(1, a, b - a + 1);
-			a = b + 1; mid = 0;
+			if (!mid) {
+				writeall(1, ts, 16);
+				written += 16;
+			}
+			writeall(1, a, b - a);
+			written += b - a;
+			mid = b[-1] != '\n'; /* the rest is in the next read */
 		}
+		if (traced) rig_trace(flush, nread, rig_now() - started);
+
+		if (limit && !mid && written >= limit)
+			written = rotate(file, written);
 	}
 
 	return 0;
@@ -0,0 +1,124 @@
+/*
+   Copyright 2017 James Hunt
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to
+   deal in the Software without restriction, including without limitation the
+   rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+   sell copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software..
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+   FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+   IN THE SOFTWARE.
+
+   ---
+
+   rig - All of the rig tools, in one (multi-call) binary
+
+   USAGE: rig TOOL args...
+          TOOL args...
+          rig -l
+          rig -T FILE
+          rig -v
+
+   Runs TOOL (always, every, init, locked, logto, runas or supervise)
+   with the given args, just as if it were its own binary.  If `rig' is
+   linked (hard or soft) to the name of a tool, running it by that name
+   works the same as `rig TOOL'.  `rig -l' lists the tools.
+
+   `rig -T FILE' prints the trace that the tools left in FILE, when
+   they were run with RIG_TRACE_FILE=FILE in their environment; one
+   line per event, oldest first (see rig.h).
+
+   When one tool runs another (i.e. always runas locked ...), and it
+   would have been `rig' anyway, the second tool is run in the same
+   process, rather than exec'ing a fresh copy of ourselves.  What an
+   exec would have done (closing close-on-exec file descriptors, and
+   resetting signal handlers) is still done.  See rig_exec() in rig.c.
+
+ */
+
+#include "rig.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+int always_main(int argc, char **argv);
+int every_main(int argc, char **argv);
+int init_main(int argc, char **argv);
+int locked_main(int argc, char **argv);
+int logto_main(int argc, char **argv);
+int runas_main(int argc, char **argv);
+int supervise_main(int argc, char **argv);
+
+static const struct rig_applet APPLETS[] = {
+	{ "always",    always_main    },
+	{ "every",     every_main     },
+	{ "init",      init_main      },
+	{ "locked",    locked_main    },
+	{ "logto",     logto_main     },
+	{ "runas",     runas_main     },
+	{ "supervise", supervise_main },
+	{ NULL, NULL },
+};
+
+static void
+usage(int rc)
+{
+	const struct rig_applet *a;
+
+	fprintf(stderr, "USAGE: rig TOOL args...\n"
+	                "\n"
+	                "TOOL is one of:");
+	for (a = APPLETS; a->name; a++)
+		fprintf(stderr, " %s", a->name);
+	fprintf(stderr, "\n");
+	exit(rc);
+}
+
+int main(int argc, char **argv)
+{
+	const struct rig_applet *a;
+
+	rig_applets = APPLETS;
+
+	/* called as `always', `runas', etc. */
+	a = rig_applet(argv[0]);
+	if (a)
+		return rig_run(a, argc, argv);
+
+	/* called as `rig TOOL ...' */
+	if (argc < 2) usage(EXIT_IMPROPER);
+	if (eq(argv[1], "-v")) show_version("rig");
+	if (eq(argv[1], "-h")) usage(EXIT_OK);
+	if (eq(argv[1], "-l")) {
+		for (a = APPLETS; a->name; a++)
+			printf("%s\n", a->name);
+		exit(EXIT_OK);
+	}
+	if (eq(argv[1], "-T")) {
+		if (argc != 3) usage(EXIT_IMPROPER);
+		if (rig_tracedump(argv[2]) != 0) {
+			fprintf(stderr, "rig: %s: %s (error %d)\n", argv[2], strerror(errno), errno);
+			exit(EXIT_RUNTIME);
+		}
+		exit(EXIT_OK);
+	}
+
+	a = rig_applet(argv[1]);
+	if (!a || strchr(argv[1], '/')) {
+		fprintf(stderr, "rig: unknown tool '%s'\n", argv[1]);
+		usage(EXIT_IMPROPER);
+	}
+	return rig_run(a, argc - 1, argv + 1);
+}
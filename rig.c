@@ -20,11 +20,41 @@
    IN THE SOFTWARE.
  */
 
+#define _DEFAULT_SOURCE /* for syscall() */
 #include "rig.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+const struct rig_applet *rig_applets = NULL;
+
+/* which applets have already run in this process (by index) */
+static unsigned long entered;
+
+/* the event loop: one epoll fd, and a handler for each fd in it */
+static int LOOP = -1;
+static struct {
+	rig_handler fn;
+	void *data;
+	unsigned gen;  /* bumped on each rig_watch() of this fd */
+} *HANDLERS;
+static int NHANDLERS;
 
 void
 show_version(const char *bin)
@@ -35,3 +65,532 @@ show_version(const char *bin)
 	printf("https://github.com/jhunt/rig\n");
 	exit(EXIT_OK);
 }
+
+/*
+   Find the applet named `name` (or, really, its basename).
+   Returns NULL if there isn't one, or if this isn't `rig'.
+ */
+const struct rig_applet *
+rig_applet(const char *name)
+{
+	const struct rig_applet *a;
+	const char *base;
+
+	if (!rig_applets || !name)
+		return NULL;
+
+	base = strrchr(name, '/');
+	base = base ? base + 1 : name;
+	for (a = rig_applets; a->name; a++)
+		if (eq(a->name, base))
+			return a;
+	return NULL;
+}
+
+/*
+   Run `applet`, in this process, as if it had been exec'd,
+   and exit with whatever it returns.
+ */
+int
+rig_run(const struct rig_applet *applet, int argc, char **argv)
+{
+	entered |= 1UL << (applet - rig_applets);
+	exit(applet->main(argc, argv));
+}
+
+/*
+   Is `path` this very binary?  Bare names (which execvp()
+   would look up in $PATH) are taken to mean us, busybox-style.
+ */
+static int
+ours(const char *path)
+{
+	struct stat a, b;
+
+	if (!strchr(path, '/'))
+		return 1;
+	return stat(path, &a) == 0 && stat("/proc/self/exe", &b) == 0
+	    && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+/*
+   Do the parts of an exec that matter to the tools: close
+   the close-on-exec file descriptors, put caught signals back
+   to their defaults, and forget where getopt() was.
+ */
+static void
+pretend(void)
+{
+	struct sigaction sa;
+	struct dirent *e;
+	DIR *d;
+	int fd, sig;
+
+	fflush(NULL);
+
+	d = opendir("/proc/self/fd");
+	if (d) {
+		while ((e = readdir(d)) != NULL) {
+			fd = atoi(e->d_name);
+			if (e->d_name[0] == '.' || fd == dirfd(d))
+				continue;
+			if (fcntl(fd, F_GETFD) & FD_CLOEXEC)
+				close(fd);
+		}
+		closedir(d);
+	}
+
+	for (sig = 1; sig <= SIGRTMAX; sig++) {
+		if (sigaction(sig, NULL, &sa) != 0)
+			continue;
+		if (sa.sa_handler != SIG_DFL && sa.sa_handler != SIG_IGN)
+			signal(sig, SIG_DFL);
+	}
+
+	optind = 0; /* glibc and musl: start over completely */
+
+	/* the epoll fd was close-on-exec, so it's gone now */
+	LOOP = -1;
+	free(HANDLERS);
+	HANDLERS = NULL;
+	NHANDLERS = 0;
+}
+
+/*
+   Exec argv[0] (searching $PATH, as per execvp).  If we are
+   `rig', and argv[0] is one of our applets that hasn't run in
+   this process yet, skip the exec, and just run it; it would
+   only have been us again anyway, minus the startup costs.
+   Like execvp(), this only returns if it fails.
+ */
+int
+rig_exec(char **argv)
+{
+	const struct rig_applet *a;
+	int argc;
+
+	a = rig_applet(argv[0]);
+	if (a && !(entered & (1UL << (a - rig_applets))) && ours(argv[0])) {
+		pretend();
+		rig_fewerfds();
+		for (argc = 0; argv[argc]; argc++)
+			;
+		rig_run(a, argc, argv);
+	}
+	rig_fewerfds();
+	return execvp(argv[0], argv);
+}
+
+/*
+   Watch `fd` for `events` (EPOLLIN, etc.), calling `fn` (with
+   `data`) from rig_dispatch() whenever any of them happen.
+   Watching an fd again replaces its events and handler.
+ */
+int
+rig_watch(int fd, unsigned events, rig_handler fn, void *data)
+{
+	struct epoll_event ev;
+	void *grown;
+	int n;
+
+	if (fd < 0 || !fn) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (LOOP < 0) {
+		LOOP = epoll_create1(EPOLL_CLOEXEC);
+		if (LOOP < 0)
+			return -1;
+	}
+	if (fd >= NHANDLERS) {
+		for (n = NHANDLERS ? NHANDLERS : 16; n <= fd; n *= 2)
+			;
+		grown = realloc(HANDLERS, n * sizeof(*HANDLERS));
+		if (!grown)
+			return -1;
+		HANDLERS = grown;
+		memset(HANDLERS + NHANDLERS, 0, (n - NHANDLERS) * sizeof(*HANDLERS));
+		NHANDLERS = n;
+	}
+
+	HANDLERS[fd].fn   = fn;
+	HANDLERS[fd].data = data;
+	HANDLERS[fd].gen++;
+
+	/* the generation tells rig_dispatch() about events that
+	   were for whatever this fd (number) was watching before */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.u64 = (uint64_t)HANDLERS[fd].gen << 32 | (uint32_t)fd;
+	if (epoll_ctl(LOOP, EPOLL_CTL_ADD, fd, &ev) == 0)
+		return 0;
+	if (errno == EEXIST && epoll_ctl(LOOP, EPOLL_CTL_MOD, fd, &ev) == 0)
+		return 0;
+	HANDLERS[fd].fn = NULL;
+	return -1;
+}
+
+/*
+   Stop watching `fd`.  Closing an fd stops epoll from watching
+   it too, but it's still best to unwatch it first, so that any
+   events for it that are already in hand get thrown out.
+ */
+int
+rig_unwatch(int fd)
+{
+	if (fd < 0 || fd >= NHANDLERS || !HANDLERS[fd].fn)
+		return 0;
+	HANDLERS[fd].fn = NULL;
+	if (epoll_ctl(LOOP, EPOLL_CTL_DEL, fd, NULL) != 0 && errno != EBADF && errno != ENOENT)
+		return -1;
+	return 0;
+}
+
+int
+rig_dispatch(int ms)
+{
+	struct epoll_event ev[64];
+	int n, i, fd, ran;
+
+	if (LOOP < 0) {
+		LOOP = epoll_create1(EPOLL_CLOEXEC);
+		if (LOOP < 0)
+			return -1;
+	}
+
+	n = epoll_wait(LOOP, ev, 64, ms);
+	if (n < 0)
+		return errno == EINTR ? 0 : -1;
+
+	for (ran = 0, i = 0; i < n; i++) {
+		fd = (int)(uint32_t)ev[i].data.u64;
+		/* an earlier handler may have unwatched this one */
+		if (fd >= NHANDLERS || !HANDLERS[fd].fn || HANDLERS[fd].gen != (unsigned)(ev[i].data.u64 >> 32))
+			continue;
+		HANDLERS[fd].fn(fd, ev[i].events, HANDLERS[fd].data);
+		ran++;
+	}
+	return ran;
+}
+
+int
+rig_signalfd(const sigset_t *mask)
+{
+	if (sigprocmask(SIG_BLOCK, mask, NULL) != 0)
+		return -1;
+	return signalfd(-1, mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+int
+rig_signal(int sfd)
+{
+	struct signalfd_siginfo si;
+
+	if (read(sfd, &si, sizeof(si)) != sizeof(si))
+		return 0;
+	return (int)si.ssi_signo;
+}
+
+long long
+rig_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int
+rig_timer(int clock)
+{
+	return timerfd_create(clock, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+int
+rig_arm(int tfd, long long ns, long long every, int flags)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	if (ns >= 0) {
+		its.it_value.tv_sec     = ns / 1000000000LL;
+		its.it_value.tv_nsec    = ns % 1000000000LL;
+		its.it_interval.tv_sec  = every / 1000000000LL;
+		its.it_interval.tv_nsec = every % 1000000000LL;
+		if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+			its.it_value.tv_nsec = 1; /* zero would disarm it */
+	}
+	return timerfd_settime(tfd, flags, &its, NULL);
+}
+
+long long
+rig_ticks(int tfd)
+{
+	uint64_t ticks;
+
+	if (read(tfd, &ticks, sizeof(ticks)) == sizeof(ticks))
+		return (long long)ticks;
+	return errno == EAGAIN ? 0 : -1;
+}
+
+int
+rig_pidfd(pid_t pid)
+{
+	int fd;
+
+#ifdef SYS_pidfd_open
+	fd = (int)syscall(SYS_pidfd_open, pid, 0);
+	if (fd >= 0)
+		fcntl(fd, F_SETFD, FD_CLOEXEC); /* it already is, but still */
+	return fd;
+#else
+	(void)pid;
+	(void)fd;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+int
+rig_kill(pid_t pid, int pidfd, int sig)
+{
+#ifdef SYS_pidfd_send_signal
+	if (pidfd >= 0)
+		return (int)syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+#else
+	(void)pidfd;
+#endif
+	return kill(pid, sig);
+}
+
+static struct rlimit NOFILE; /* from before rig_morefds() */
+static int MOREFDS = 0;
+
+int
+rig_morefds(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+		return -1;
+	if (!MOREFDS)
+		NOFILE = rl;
+	rl.rlim_cur = rl.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &rl) != 0)
+		return -1;
+	MOREFDS = 1;
+	return 0;
+}
+
+void
+rig_fewerfds(void)
+{
+	if (MOREFDS)
+		setrlimit(RLIMIT_NOFILE, &NOFILE);
+}
+
+pid_t
+rig_spawn(const char *program, char **argv, const sigset_t *mask, const int fds[3])
+{
+	pid_t pid;
+	int i;
+
+	pid = fork();
+	if (pid != 0) {
+		if (pid > 0)
+			rig_trace(spawn, pid, 0);
+		return pid;
+	}
+
+	/* signal masks survive exec; don't hand ours down */
+	if (mask)
+		sigprocmask(SIG_UNBLOCK, mask, NULL);
+	/* dup2() clears close-on-exec, but is a no-op if fds[i] is
+	   already i, so that one has to be cleared by hand */
+	for (i = 0; fds && i < 3; i++)
+		if (fds[i] >= 0 && (fds[i] == i ? fcntl(i, F_SETFD, 0) : dup2(fds[i], i)) < 0) {
+			fprintf(stderr, "%s: failed to set up fd %d for '%s': %s (error %d)\n", program, i, argv[0], strerror(errno), errno);
+			exit(EXIT_IN_CHILD);
+		}
+
+	rig_exec(argv);
+	fprintf(stderr, "%s: failed to exec '%s': %s (error %d)\n", program, argv[0], strerror(errno), errno);
+	exit(EXIT_IN_CHILD);
+}
+
+const char *
+rig_status(int status)
+{
+	static char buf[128];
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_IN_CHILD)
+		snprintf(buf, sizeof(buf), "never got started (rc=%d)", EXIT_IN_CHILD);
+	else if (WIFEXITED(status))
+		snprintf(buf, sizeof(buf), "exited with rc=%d", WEXITSTATUS(status));
+	else if (WIFSIGNALED(status))
+		snprintf(buf, sizeof(buf), "killed with signal %d (%s)%s", WTERMSIG(status),
+			strsignal(WTERMSIG(status)), WCOREDUMP(status) ? ", dumping core" : "");
+	else if (WIFSTOPPED(status))
+		snprintf(buf, sizeof(buf), "stopped with signal %d", WSTOPSIG(status));
+	else
+		snprintf(buf, sizeof(buf), "died with unrecognized status of %d (%08x)", status, status);
+	return buf;
+}
+
+/*
+   The trace file ($RIG_TRACE_FILE) is a header, and then a ring
+   of fixed-size records, mmap()'d shared, so that everything
+   tracing into it (supervise, the always under it, and so on)
+   can share one.  Writers claim a record by bumping `head`
+   (atomically), fill it in, and set its `seq` last; readers
+   skip any record whose seq isn't the one they expect there.
+ */
+#define TRACE_MAGIC   "rigtrace"
+#define TRACE_VERSION 1
+#define TRACE_SLOTS   65536 /* 2.5MB worth */
+
+struct trace_head {
+	char     magic[8];
+	uint32_t version;
+	uint32_t slots;
+	uint64_t head;     /* records ever claimed */
+	char     pad[40];
+};
+
+struct trace_rec {
+	uint64_t seq;      /* index + 1; 0 while being written */
+	uint64_t ns;       /* CLOCK_MONOTONIC */
+	int64_t  a, b;
+	int32_t  pid;
+	uint16_t event;
+	uint16_t pad;
+};
+
+static const char *EVENTS[] = {
+	"?", "spawn", "exit", "restart", "lock", "flush", "rotate",
+};
+
+int rig_tracing = -1; /* -1 until the first tracepoint */
+static struct trace_head *TRACE;
+
+static struct trace_head *
+tracemap(const char *path, int create)
+{
+	struct trace_head *h;
+	struct stat st;
+	size_t len;
+	void *m;
+	int fd;
+
+	fd = open(path, create ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return NULL;
+
+	len = sizeof(struct trace_head) + TRACE_SLOTS * sizeof(struct trace_rec);
+	if (fstat(fd, &st) != 0 || (create && st.st_size == 0 && ftruncate(fd, len) != 0)) {
+		close(fd);
+		return NULL;
+	}
+	if (st.st_size != 0)
+		len = st.st_size;
+	if (len < sizeof(struct trace_head)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	m = mmap(NULL, len, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED)
+		return NULL;
+
+	/* a brand new (all zeros) file; if two of us get here at
+	   once, we both write the same thing, and that's fine */
+	h = m;
+	if (create && !h->slots) {
+		memcpy(h->magic, TRACE_MAGIC, sizeof(h->magic));
+		h->version = TRACE_VERSION;
+		__atomic_store_n(&h->slots, TRACE_SLOTS, __ATOMIC_RELEASE);
+	}
+
+	if (memcmp(h->magic, TRACE_MAGIC, sizeof(h->magic)) != 0 || h->version != TRACE_VERSION
+	 || !h->slots || len < sizeof(*h) + (size_t)h->slots * sizeof(struct trace_rec)) {
+		munmap(m, len);
+		errno = EINVAL;
+		return NULL;
+	}
+	return h;
+}
+
+/*
+   Record an event in the trace file.  Don't call this directly;
+   use rig_trace(), which skips it when there's no trace file.
+ */
+void
+rig_tracef(int event, long long a, long long b)
+{
+	struct trace_rec *r;
+	const char *path;
+	uint64_t i;
+
+	if (rig_tracing < 0) {
+		path = getenv("RIG_TRACE_FILE");
+		if (path && *path) {
+			TRACE = tracemap(path, 1);
+			if (!TRACE)
+				fprintf(stderr, "rig: not tracing to %s: %s (error %d)\n", path, strerror(errno), errno);
+		}
+		rig_tracing = TRACE != NULL;
+	}
+	if (!TRACE)
+		return;
+
+	i = __atomic_fetch_add(&TRACE->head, 1, __ATOMIC_RELAXED);
+	r = (struct trace_rec *)(TRACE + 1) + i % TRACE->slots;
+	__atomic_store_n(&r->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	r->ns    = (uint64_t)rig_now();
+	r->a     = a;
+	r->b     = b;
+	r->pid   = (int32_t)getpid();
+	r->event = (uint16_t)event;
+	__atomic_store_n(&r->seq, i + 1, __ATOMIC_RELEASE);
+}
+
+/*
+   Print out everything still in the trace file at `path`,
+   oldest first.  Returns 0, or -1 (with errno set) if `path`
+   isn't a trace file.
+ */
+int
+rig_tracedump(const char *path)
+{
+	struct trace_head *h;
+	struct trace_rec *r, rec;
+	uint64_t n, i;
+
+	h = tracemap(path, 0);
+	if (!h)
+		return -1;
+
+	n = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+	for (i = n > h->slots ? n - h->slots : 0; i < n; i++) {
+		r = (struct trace_rec *)(h + 1) + i % h->slots;
+		if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != i + 1)
+			continue; /* being (over)written */
+		memcpy(&rec, r, sizeof(rec));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&r->seq, __ATOMIC_RELAXED) != i + 1)
+			continue;
+
+		printf("%llu %.6f %d %s %lld %lld", (unsigned long long)rec.seq, rec.ns / 1e9, (int)rec.pid,
+			rec.event < sizeof(EVENTS) / sizeof(EVENTS[0]) ? EVENTS[rec.event] : "?",
+			(long long)rec.a, (long long)rec.b);
+		if (rec.event == RIG_TRACE_exit)
+			printf(" (%s)", rig_status((int)rec.b));
+		printf("\n");
+	}
+	munmap(h, sizeof(*h) + (size_t)h->slots * sizeof(struct trace_rec));
+	return 0;
+}
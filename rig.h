@@ -12,9 +12,155 @@
 #define EXIT_IN_CHILD 251
 
 #include <string.h>
+#include <signal.h>
+#include <sys/types.h>
 
 void show_version(const char *bin);
 
 #define eq(s1,s2) (strcmp((s1), (s2)) == 0)
 
+/*
+   Multi-call support.  In the `rig' binary (see multi.c),
+   rig_applets lists all of the tools; everywhere else, it's
+   NULL, and rig_exec() is just execvp().
+ */
+struct rig_applet {
+	const char *name;
+	int (*main)(int argc, char **argv);
+};
+extern const struct rig_applet *rig_applets;
+
+const struct rig_applet *rig_applet(const char *name);
+int rig_run(const struct rig_applet *applet, int argc, char **argv);
+int rig_exec(char **argv);
+
+/*
+   The event loop.  Each process gets one (it's epoll, under
+   the hood); watch an fd with a handler, and rig_dispatch()
+   calls that handler whenever the fd is ready.  rig_dispatch()
+   waits at most `ms` milliseconds (forever, if negative), and
+   returns how many handlers it ran, or -1 if epoll failed.
+ */
+typedef void (*rig_handler)(int fd, unsigned events, void *data);
+
+int rig_watch(int fd, unsigned events, rig_handler fn, void *data);
+int rig_unwatch(int fd);
+int rig_dispatch(int ms);
+
+/*
+   Signals, via signalfd: rig_signalfd() blocks everything in
+   `mask`, and returns a (non-blocking) signalfd for it, which
+   rig_signal() reads; it returns 0 once nothing is pending.
+ */
+int rig_signalfd(const sigset_t *mask);
+int rig_signal(int sfd);
+
+/*
+   Timers, via timerfd.  rig_arm() sets the timer to go off in
+   `ns` nanoseconds (or at `ns`, with TFD_TIMER_ABSTIME in the
+   `flags`), and then every `every` nanoseconds, if that's not
+   zero.  A negative `ns` disarms it.  rig_ticks() reads how
+   many times it has gone off (0 if it hasn't), or returns -1
+   (ECANCELED, with TFD_TIMER_CANCEL_ON_SET) if the clock jumped.
+ */
+long long rig_now(void); /* CLOCK_MONOTONIC, in nanoseconds */
+int rig_timer(int clock);
+int rig_arm(int tfd, long long ns, long long every, int flags);
+long long rig_ticks(int tfd);
+
+/*
+   Process handles.  rig_pidfd() returns -1 (ENOSYS) on kernels
+   that don't have them; rig_kill() falls back to plain kill()
+   when `pidfd` is negative.  Signalling by pidfd can't hit an
+   unrelated process that happened to be handed a recycled pid.
+ */
+int rig_pidfd(pid_t pid);
+int rig_kill(pid_t pid, int pidfd, int sig);
+
+/*
+   Fork, and run `argv` (via rig_exec) in the child, with the
+   signals in `mask` unblocked, and (unless `fds` is NULL)
+   fds[0..2] as its standard input, output and error (leave
+   any of those that are negative alone).  If the exec fails,
+   the child says so (as `program`), and exits EXIT_IN_CHILD.
+   Returns the child's pid, or -1 if the fork failed.
+ */
+pid_t rig_spawn(const char *program, char **argv, const sigset_t *mask, const int fds[3]);
+
+/*
+   Raise our soft limit on open files as far as the hard limit
+   goes, for things (like supervise) that hold a lot of them.
+   rig_exec() (and so rig_spawn()) puts the original limit back
+   for whatever it runs; anything that execs for itself should
+   call rig_fewerfds() just before it does.  (Not any earlier:
+   until the exec, we may still be holding more fds than that.)
+ */
+int rig_morefds(void);
+void rig_fewerfds(void);
+
+/*
+   Describe a wait() status, i.e. "exited with rc=2", or
+   "killed with signal 9 (Killed)".  The string is static.
+ */
+const char *rig_status(int status);
+
+/*
+   Tracing.  Tracepoints look like
+
+       rig_trace(spawn, pid, 0);
+
+   and are always two (integer) arguments; what they mean is up
+   to the event (see rig.c).  Each one is a USDT probe (provider
+   `rig'), if <sys/sdt.h> is around at build time, for perf,
+   bpftrace and SystemTap to attach to.  They also go into the
+   binary ring buffer in $RIG_TRACE_FILE, if that's set; `rig -T
+   FILE' dumps it.  Otherwise, a tracepoint costs a branch.
+
+   Arguments are only worked out when someone might be listening.
+   If one costs something beyond that (a clock read to time what
+   comes before the tracepoint, say), check rig_traced() first.
+   With USDT probes built in, that's always true, since there's no
+   telling when perf or bpftrace will attach.
+
+   Build with -DRIG_TRACE=0 (make TRACE=0) to compile them out.
+ */
+#ifndef RIG_TRACE
+#define RIG_TRACE 1
+#endif
+
+#define RIG_TRACE_spawn   1 /* pid,      0                  */
+#define RIG_TRACE_exit    2 /* pid,      wait() status      */
+#define RIG_TRACE_restart 3 /* delay ms, quick deaths so far */
+#define RIG_TRACE_lock    4 /* ns waited, slot (or -1)       */
+#define RIG_TRACE_flush   5 /* bytes,    ns spent writing    */
+#define RIG_TRACE_rotate  6 /* bytes in the old file, 0      */
+
+#if RIG_TRACE && defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#    include <sys/sdt.h>
+#    define RIG_SDT(ev,a,b) STAP_PROBE2(rig, ev, (long long)(a), (long long)(b))
+#    define RIG_SDT_ON 1
+#  endif
+#endif
+#ifndef RIG_SDT
+#  define RIG_SDT(ev,a,b) do { } while (0)
+#  define RIG_SDT_ON 0
+#endif
+
+extern int rig_tracing; /* 0 once we know there's no trace file */
+void rig_tracef(int event, long long a, long long b);
+int rig_tracedump(const char *path);
+
+#if RIG_TRACE
+#define rig_trace(ev,a,b) do { \
+	RIG_SDT(ev, a, b); \
+	if (rig_tracing) rig_tracef(RIG_TRACE_ ## ev, (long long)(a), (long long)(b)); \
+} while (0)
+#define rig_traced() (RIG_SDT_ON || rig_tracing)
+#else
+#define rig_traced() 0
+/* never evaluated, but still "used" (no unused variable warnings) */
+#define rig_trace(ev,a,b) do { if (0) { (void)(a); (void)(b); } } while (0)
+#endif
+
 #endif
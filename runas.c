@@ -23,31 +23,321 @@
 
    runas - Execute a program with a different real/effective UID/GID
 
-   USAGE: runas user group path/to/command args...
+   USAGE: runas [OPTIONS] user group path/to/command args...
           runas -v
 
+   Options:
+
+     -G        Give the command all of the user's supplementary groups
+               (per getgrouplist(3)), instead of none at all.
+
+     -C FILE   Cache user / group lookups in FILE, so that hosts with
+               slow name services (LDAP, SSSD, etc.) only pay for them
+               once.  The cache is thrown out whenever /etc/passwd,
+               /etc/group or /etc/nsswitch.conf change, and after an
+               hour regardless (changes in LDAP don't touch any of
+               those files).  The cache must be owned by whoever runs
+               runas, and not be writable by anyone else; if it isn't,
+               it's ignored.
+
+   The rest of the options do the jobs of ulimit, nice, ionice, taskset
+   and setpriv, so that none of them need to go in front of runas:
+
+     -l RES=SOFT[:HARD]
+               Set a resource limit (see setrlimit(2)), by its name:
+               nofile, nproc, memlock, core, as, data, stack, fsize,
+               cpu, locks, sigpending, msgqueue, nice, rtprio or
+               rttime.  SOFT and HARD are numbers, or `unlimited'; if
+               HARD is left off, it is the same as SOFT.  Can be given
+               more than once.
+
+     -n NICE   Set the niceness (-20 to 19) of the command.
+
+     -i CLASS[:LEVEL]
+               Set the I/O scheduling class (rt, be or idle) and
+               priority level (0 - 7; the default is 4) of the command.
+
+     -a CPUS   Pin the command to the given CPUs, i.e. `0-3,8'.
+
+     -N        Set no_new_privs, so that the command (and anything it
+               runs) can never gain privileges, via setuid binaries,
+               file capabilities, and the like.
+
+   Everything but -N is done before giving up root (since raising limits
+   and lowering niceness need it); -N is done last, right before exec.
+
  */
 
-#define _BSD_SOURCE
+#define _DEFAULT_SOURCE
 #include "rig.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <pwd.h>
 #include <grp.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
 
 #define PROGRAM "runas"
 
+/* how long (in seconds) a -C cache is good for, at most */
+#define CACHE_TTL 3600
+
+/* the most supplementary groups we'll set with -G */
+#define MAXGROUPS 1024
+
+/* the most CPUs we can pin to with -a */
+#define MAXCPUS 4096
+
+/* from linux/ioprio.h, which isn't always around */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+
+static const struct {
+	const char *name;
+	int resource;
+} RLIMITS[] = {
+	{ "nofile",     RLIMIT_NOFILE     },
+	{ "nproc",      RLIMIT_NPROC      },
+	{ "memlock",    RLIMIT_MEMLOCK    },
+	{ "core",       RLIMIT_CORE       },
+	{ "as",         RLIMIT_AS         },
+	{ "data",       RLIMIT_DATA       },
+	{ "stack",      RLIMIT_STACK      },
+	{ "fsize",      RLIMIT_FSIZE      },
+	{ "cpu",        RLIMIT_CPU        },
+	{ "locks",      RLIMIT_LOCKS      },
+	{ "sigpending", RLIMIT_SIGPENDING },
+	{ "msgqueue",   RLIMIT_MSGQUEUE   },
+	{ "nice",       RLIMIT_NICE       },
+	{ "rtprio",     RLIMIT_RTPRIO     },
+	{ "rttime",     RLIMIT_RTTIME     },
+	{ NULL, 0 },
+};
+
+/*
+   Everything we have to do to the process before the exec,
+   besides switching users; see the -l, -n, -i, -a and -N
+   options, above.
+ */
+static struct {
+	int nlimits;
+	struct {
+		int resource;
+		struct rlimit rl;
+		const char *spec;
+	} limits[32];
+
+	int renice, nice;
+	int ionice, ioprio;
+	int pin;
+	unsigned long cpus[MAXCPUS / (8 * sizeof(unsigned long))];
+	int nnp;
+} TUNE;
+
+/*
+   The -C cache, in memory, is just the text of the file:
+   one `KIND KEY VALUE' entry per line, after the stamp line,
+   which has the mtimes of the files we depend on, and when
+   the cache was started.
+ */
+static struct {
+	const char *path;  /* where it lives (NULL = no cache) */
+	char  stamp[128];  /* what its first line should be    */
+	char *text;        /* all of the entries               */
+	size_t len, cap;
+	long created;      /* when the cache was started       */
+	int dirty;         /* needs to be written back out?    */
+} CACHE;
+
 static void
 usage(int rc)
 {
-	fprintf(stderr, "USAGE: runas user group path/to/command args...\n");
+	fprintf(stderr, "USAGE: runas [-G] [-C /path/to/cache] [-l RES=SOFT[:HARD]] [-n NICE]\n"
+	                "             [-i CLASS[:LEVEL]] [-a CPUS] [-N] user group path/to/command args...\n");
 	exit(rc);
 }
 
+static void
+mtime(const char *path)
+{
+	struct stat st;
+	size_t n;
+
+	if (stat(path, &st) != 0)
+		memset(&st, 0, sizeof(st));
+	n = strlen(CACHE.stamp);
+	snprintf(CACHE.stamp + n, sizeof(CACHE.stamp) - n, " %ld.%09ld",
+		(long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec);
+}
+
+/*
+   Load up the cache at `path`, unless it's stale (or fishy),
+   in which case we start over with an empty one.
+ */
+static void
+load(const char *path)
+{
+	struct stat st;
+	char *nl;
+	size_t k;
+	ssize_t n;
+	int fd;
+
+	CACHE.path = path;
+	CACHE.created = time(NULL);
+	strcpy(CACHE.stamp, "runas-cache");
+	mtime("/etc/passwd");
+	mtime("/etc/group");
+	mtime("/etc/nsswitch.conf");
+
+	fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd < 0)
+		return;
+
+	/* anyone else who can write to it can tell us who root is */
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+	 || st.st_uid != geteuid() || (st.st_mode & 022)) {
+		fprintf(stderr, PROGRAM ": ignoring untrustworthy cache '%s'\n", path);
+		close(fd);
+		return;
+	}
+
+	CACHE.text = malloc(st.st_size + 1);
+	if (!CACHE.text) {
+		close(fd);
+		return;
+	}
+	for (CACHE.len = 0; CACHE.len < (size_t)st.st_size; CACHE.len += n) {
+		n = read(fd, CACHE.text + CACHE.len, st.st_size - CACHE.len);
+		if (n <= 0) break;
+	}
+	close(fd);
+	CACHE.text[CACHE.len] = '\0';
+	CACHE.cap = CACHE.len + 1;
+
+	/* first line: the stamp, then when the cache was started */
+	k = strlen(CACHE.stamp);
+	nl = strchr(CACHE.text, '\n');
+	if (!nl || strncmp(CACHE.text, CACHE.stamp, k) != 0 || CACHE.text[k] != ' ') {
+		CACHE.len = 0;
+		CACHE.text[0] = '\0';
+		return;
+	}
+	CACHE.created = strtol(CACHE.text + k + 1, NULL, 10);
+	if (CACHE.created > time(NULL) || time(NULL) - CACHE.created > CACHE_TTL) {
+		CACHE.created = time(NULL);
+		CACHE.len = 0;
+		CACHE.text[0] = '\0';
+		return;
+	}
+
+	/* skip the stamp line */
+	CACHE.len -= nl + 1 - CACHE.text;
+	memmove(CACHE.text, nl + 1, CACHE.len + 1);
+}
+
+/*
+   Look up the cached value of `kind` for `key`, copying it
+   into `val` (of size `len`).  Returns 0 if found, -1 if not.
+   If it's in there more than once, the last one (i.e. the one
+   that replaced a bad entry) wins.
+ */
+static int
+cached(const char *kind, const char *key, char *val, size_t len)
+{
+	char *p, *nl, *v, *end;
+	size_t k, n;
+
+	if (!CACHE.text)
+		return -1;
+
+	k = strlen(kind);
+	n = strlen(key);
+	v = end = NULL;
+	for (p = CACHE.text; *p; p = nl + 1) {
+		nl = strchr(p, '\n');
+		if (!nl)
+			break;
+		if (strncmp(p, kind, k) == 0 && p[k] == ' '
+		 && strncmp(p + k + 1, key, n) == 0 && p[k + 1 + n] == ' ') {
+			v = p + k + 1 + n + 1;
+			end = nl;
+		}
+	}
+	if (!v || (size_t)(end - v) >= len)
+		return -1;
+	memcpy(val, v, end - v);
+	val[end - v] = '\0';
+	return 0;
+}
+
+/*
+   Add an entry to the cache (if we have one).
+ */
+static void
+remember(const char *kind, const char *key, const char *val)
+{
+	size_t n;
+	char *t;
+
+	if (!CACHE.path || strpbrk(key, " \n") || strchr(val, '\n'))
+		return;
+
+	n = strlen(kind) + strlen(key) + strlen(val) + 3;
+	if (CACHE.len + n + 1 > CACHE.cap) {
+		t = realloc(CACHE.text, (CACHE.len + n + 1) * 2);
+		if (!t)
+			return;
+		CACHE.text = t;
+		CACHE.cap = (CACHE.len + n + 1) * 2;
+	}
+	CACHE.len += snprintf(CACHE.text + CACHE.len, n + 1, "%s %s %s\n", kind, key, val);
+	CACHE.dirty = 1;
+}
+
+/*
+   Write the cache back out, if anything changed; via a temp
+   file, so that nobody else ever reads half of it.  Failing
+   to do so isn't worth failing the exec over.
+ */
+static void
+save(void)
+{
+	char tmp[4096];
+	FILE *io;
+	int fd;
+
+	if (!CACHE.path || !CACHE.dirty)
+		return;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.%d", CACHE.path, (int)getpid()) >= (int)sizeof(tmp))
+		return;
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (fd < 0 || !(io = fdopen(fd, "w"))) {
+		fprintf(stderr, PROGRAM ": failed to write cache '%s': %s (error %d)\n", tmp, strerror(errno), errno);
+		if (fd >= 0) close(fd);
+		return;
+	}
+
+	fprintf(io, "%s %ld\n", CACHE.stamp, CACHE.created);
+	if (CACHE.text)
+		fwrite(CACHE.text, 1, CACHE.len, io);
+
+	if (fclose(io) != 0 || rename(tmp, CACHE.path) != 0) {
+		fprintf(stderr, PROGRAM ": failed to write cache '%s': %s (error %d)\n", CACHE.path, strerror(errno), errno);
+		unlink(tmp);
+	}
+}
+
 static int
 parseint(const char *s)
 {
@@ -67,61 +357,314 @@ static uid_t
 parseuid(const char *s)
 {
 	int id;
+	char buf[32];
 	struct passwd * pw;
 
 	id = parseint(s);
 	if (id >= 0) return id;
 
+	if (cached("user", s, buf, sizeof(buf)) == 0)
+		return (uid_t)strtoul(buf, NULL, 10);
+
 	pw = getpwnam(s);
-	return pw ? pw->pw_uid : -1;
+	if (!pw) return -1;
+	snprintf(buf, sizeof(buf), "%u", (unsigned)pw->pw_uid);
+	remember("user", s, buf);
+	return pw->pw_uid;
 }
 
 static gid_t
 parsegid(const char *s)
 {
 	int id;
+	char buf[32];
 	struct group *gr;
 
 	id = parseint(s);
 	if (id >= 0) return id;
 
+	if (cached("group", s, buf, sizeof(buf)) == 0)
+		return (gid_t)strtoul(buf, NULL, 10);
+
 	gr = getgrnam(s);
-	return gr ? gr->gr_gid : -1;
+	if (!gr) return -1;
+	snprintf(buf, sizeof(buf), "%u", (unsigned)gr->gr_gid);
+	remember("group", s, buf);
+	return gr->gr_gid;
+}
+
+/*
+   Work out the supplementary groups for `user` (as given on
+   the command-line; a name or a UID), with primary group `gid`,
+   into `groups`.  Returns how many there are, or -1 if we
+   can't figure that out.
+ */
+static int
+grouplist(const char *user, uid_t uid, gid_t gid, gid_t *groups)
+{
+	char name[256], key[sizeof(name) + 16], buf[MAXGROUPS * 12], *p, *end;
+	struct passwd *pw;
+	int i, n;
+
+	/* getgrouplist() wants a name */
+	if (parseint(user) >= 0) {
+		snprintf(key, sizeof(key), "%u", (unsigned)uid);
+		if (cached("uid", key, name, sizeof(name)) != 0) {
+			pw = getpwuid(uid);
+			if (!pw || strlen(pw->pw_name) >= sizeof(name))
+				return -1;
+			strcpy(name, pw->pw_name);
+			remember("uid", key, name);
+		}
+		user = name;
+	}
+
+	if (snprintf(key, sizeof(key), "%s:%u", user, (unsigned)gid) >= (int)sizeof(key))
+		return -1;
+	if (cached("groups", key, buf, sizeof(buf)) == 0) {
+		for (n = 0, p = buf; *p; n++, p = end) {
+			if (n == MAXGROUPS || *p < '0' || *p > '9')
+				break;
+			groups[n] = (gid_t)strtoul(p, &end, 10);
+			if (*end == ',') end++;
+			else if (*end) break;
+		}
+		if (!*p)
+			return n;
+		/* not a list of gids (as we'd have written it);
+		   don't trust any of it, and ask again */
+	}
+
+	n = MAXGROUPS;
+	if (getgrouplist(user, gid, groups, &n) < 0)
+		return -1;
+
+	for (p = buf, i = 0; i < n; i++)
+		p += snprintf(p, sizeof(buf) - (p - buf), i ? ",%u" : "%u", (unsigned)groups[i]);
+	remember("groups", key, buf);
+	return n;
+}
+
+static void
+invalid(const char *what, const char *v)
+{
+	fprintf(stderr, PROGRAM ": invalid %s '%s'\n", what, v);
+	exit(EXIT_IMPROPER);
+}
+
+static rlim_t
+rlimit(const char *v, const char **end, const char *spec)
+{
+	char *e;
+	rlim_t n;
+
+	if (!strncmp(v, "unlimited", 9)) {
+		*end = v + 9;
+		return RLIM_INFINITY;
+	}
+	if (*v < '0' || *v > '9')
+		invalid("resource limit", spec);
+	n = (rlim_t)strtoull(v, &e, 10);
+	*end = e;
+	return n;
+}
+
+/*
+   Parse a -l RES=SOFT[:HARD] resource limit.
+ */
+static void
+limit(const char *spec)
+{
+	const char *eq, *p;
+	int i;
+
+	if (TUNE.nlimits == (int)(sizeof(TUNE.limits) / sizeof(TUNE.limits[0])))
+		invalid("resource limit (too many -l options)", spec);
+
+	eq = strchr(spec, '=');
+	if (!eq)
+		invalid("resource limit", spec);
+	for (i = 0; RLIMITS[i].name; i++)
+		if (strlen(RLIMITS[i].name) == (size_t)(eq - spec)
+		 && !strncmp(RLIMITS[i].name, spec, eq - spec))
+			break;
+	if (!RLIMITS[i].name)
+		invalid("resource name in limit", spec);
+
+	TUNE.limits[TUNE.nlimits].resource = RLIMITS[i].resource;
+	TUNE.limits[TUNE.nlimits].spec = spec;
+	TUNE.limits[TUNE.nlimits].rl.rlim_cur = rlimit(eq + 1, &p, spec);
+	TUNE.limits[TUNE.nlimits].rl.rlim_max = TUNE.limits[TUNE.nlimits].rl.rlim_cur;
+	if (*p == ':')
+		TUNE.limits[TUNE.nlimits].rl.rlim_max = rlimit(p + 1, &p, spec);
+	if (*p)
+		invalid("resource limit", spec);
+	if (TUNE.limits[TUNE.nlimits].rl.rlim_cur > TUNE.limits[TUNE.nlimits].rl.rlim_max)
+		invalid("resource limit (soft limit is over the hard limit)", spec);
+	TUNE.nlimits++;
+}
+
+/*
+   Parse a -i CLASS[:LEVEL] I/O scheduling spec.
+ */
+static void
+ionice(const char *spec)
+{
+	const char *p;
+	size_t n;
+	int level;
+
+	p = strchr(spec, ':');
+	n = p ? (size_t)(p - spec) : strlen(spec);
+	if      (n == 2 && !strncmp(spec, "rt",   2)) TUNE.ionice = 1;
+	else if (n == 2 && !strncmp(spec, "be",   2)) TUNE.ionice = 2;
+	else if (n == 4 && !strncmp(spec, "idle", 4)) TUNE.ionice = 3;
+	else invalid("I/O scheduling class", spec);
+
+	level = 4;
+	if (p) {
+		if (p[1] < '0' || p[1] > '7' || p[2])
+			invalid("I/O priority level (must be 0-7)", spec);
+		level = p[1] - '0';
+	}
+	TUNE.ioprio = (TUNE.ionice << IOPRIO_CLASS_SHIFT) | (TUNE.ionice == 3 ? 0 : level);
+}
+
+/*
+   Parse a -a CPU list, like `0-3,8,10-11'.
+ */
+static void
+cpulist(const char *spec)
+{
+	const char *p;
+	char *end;
+	unsigned long a, b;
+	size_t bits;
+
+	bits = 8 * sizeof(unsigned long);
+	for (p = spec; ; p = end + 1) {
+		if (*p < '0' || *p > '9')
+			invalid("CPU list", spec);
+		a = b = strtoul(p, &end, 10);
+		if (*end == '-') {
+			p = end + 1;
+			if (*p < '0' || *p > '9')
+				invalid("CPU list", spec);
+			b = strtoul(p, &end, 10);
+		}
+		if (a > b || b >= MAXCPUS)
+			invalid("CPU list", spec);
+		for (; a <= b; a++)
+			TUNE.cpus[a / bits] |= 1UL << (a % bits);
+		if (*end != ',')
+			break;
+	}
+	if (*end)
+		invalid("CPU list", spec);
+	TUNE.pin = 1;
+}
+
+/*
+   Apply the -l, -n, -i and -a settings to ourselves (and so,
+   to the command we exec).
+ */
+static void
+tune(void)
+{
+	int i;
+
+	for (i = 0; i < TUNE.nlimits; i++) {
+		if (setrlimit(TUNE.limits[i].resource, &TUNE.limits[i].rl) != 0) {
+			fprintf(stderr, PROGRAM ": failed to set resource limit %s: %s (error %d)\n",
+					TUNE.limits[i].spec, strerror(errno), errno);
+			exit(EXIT_RUNTIME);
+		}
+	}
+
+	if (TUNE.renice && setpriority(PRIO_PROCESS, 0, TUNE.nice) != 0) {
+		fprintf(stderr, PROGRAM ": failed to set niceness to %d: %s (error %d)\n",
+				TUNE.nice, strerror(errno), errno);
+		exit(EXIT_RUNTIME);
+	}
+
+	if (TUNE.ionice && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, TUNE.ioprio) != 0) {
+		fprintf(stderr, PROGRAM ": failed to set I/O scheduling class: %s (error %d)\n",
+				strerror(errno), errno);
+		exit(EXIT_RUNTIME);
+	}
+
+	if (TUNE.pin && syscall(SYS_sched_setaffinity, 0, sizeof(TUNE.cpus), TUNE.cpus) != 0) {
+		fprintf(stderr, PROGRAM ": failed to set CPU affinity: %s (error %d)\n",
+				strerror(errno), errno);
+		exit(EXIT_RUNTIME);
+	}
 }
 
 int main(int argc, char **argv)
 {
 	uid_t uid;
-	gid_t gid;
+	gid_t gid, groups[MAXGROUPS];
+	char *end;
+	int opt, all, n;
 
-	if (argc > 1 && argv[1][0] == '-') {
-		if (eq(argv[1], "-v")) show_version(PROGRAM);
-		if (eq(argv[1], "-h")) usage(EXIT_OK);
-		usage(EXIT_IMPROPER);
+	all = n = 0;
+	if (argc > 1 && eq(argv[1], "-v")) show_version(PROGRAM);
+	while ((opt = getopt(argc, argv, "+hGC:l:n:i:a:N")) != -1) {
+		switch (opt) {
+		case 'h': usage(EXIT_OK);
+		case 'G': all = 1; break;
+		case 'C': load(optarg); break;
+		case 'l': limit(optarg); break;
+		case 'i': ionice(optarg); break;
+		case 'a': cpulist(optarg); break;
+		case 'N': TUNE.nnp = 1; break;
+		case 'n':
+			TUNE.renice = 1;
+			TUNE.nice = (int)strtol(optarg, &end, 10);
+			if (*end || end == optarg || TUNE.nice < -20 || TUNE.nice > 19)
+				invalid("niceness (must be -20 to 19)", optarg);
+			break;
+		default:  usage(EXIT_IMPROPER);
+		}
 	}
+	argc -= optind - 1; argv += optind - 1;
 	if (argc < 4) usage(EXIT_IMPROPER);
 
 	uid = parseuid(argv[1]);
-	if (uid < 0) {
+	if (uid == (uid_t)-1) {
 		fprintf(stderr, PROGRAM ": no such user '%s'\n", argv[1]);
 		exit(EXIT_IMPROPER);
 	}
 
 	gid = parsegid(argv[2]);
-	if (gid < 0) {
+	if (gid == (gid_t)-1) {
 		fprintf(stderr, PROGRAM ": no such group '%s'\n", argv[2]);
 		exit(EXIT_IMPROPER);
 	}
 
+	if (all) {
+		n = grouplist(argv[1], uid, gid, groups);
+		if (n < 0) {
+			fprintf(stderr, PROGRAM ": failed to look up supplementary groups for '%s'\n", argv[1]);
+			exit(EXIT_IMPROPER);
+		}
+	}
+
+	/* while we can still write wherever the cache lives */
+	save();
+
+	/* while we can still raise limits and priorities */
+	tune();
+
 	if (setregid(gid, gid) != 0) {
 		fprintf(stderr, PROGRAM ": failed to set real/effective group id to %d (%s): %s (error %d)\n",
 				gid, argv[2], strerror(errno), errno);
 		exit(EXIT_RUNTIME);
 	}
 
-	if (setgroups(0, NULL) != 0) {
-		fprintf(stderr, PROGRAM ": failed to clear auxiliary groups: %s (error %d)\n",
-				strerror(errno), errno);
+	if (setgroups(n, n ? groups : NULL) != 0) {
+		fprintf(stderr, PROGRAM ": failed to %s auxiliary groups: %s (error %d)\n",
+				n ? "set" : "clear", strerror(errno), errno);
 		exit(EXIT_RUNTIME);
 	}
 
@@ -131,7 +674,13 @@ int main(int argc, char **argv)
 		exit(EXIT_RUNTIME);
 	}
 
-	execvp(argv[3], &argv[3]);
+	if (TUNE.nnp && prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0) {
+		fprintf(stderr, PROGRAM ": failed to set no_new_privs: %s (error %d)\n",
+				strerror(errno), errno);
+		exit(EXIT_RUNTIME);
+	}
+
+	rig_exec(&argv[3]);
 	fprintf(stderr, PROGRAM ": failed to exec '%s': %s (error %d)\n", argv[3], strerror(errno), errno);
 	exit(EXIT_RUNTIME);
 }
@@ -27,6 +27,22 @@
    USAGE: supervise /path/to/services [/another/path ...]
           supervise -v
 
+   Every executable file in the services directory gets run (under
+   `always'), and restarted if it ever exits.  New services are
+   picked up as soon as they show up (via inotify), and the whole
+   directory is rescanned every couple of seconds, regardless.
+
+   Each service's standard output and error go into a pipe that
+   supervise sets up (once) and keeps hold of, for as long as it
+   runs, so that nothing is lost when either end of it restarts.
+   The other end is read by `logto', into log/SERVICE (rotated
+   to log/SERVICE.1 every 16MB), which gets restarted just like
+   the services do.  supervise itself never reads or writes any
+   of that, so a slow or stuck logto only ever holds up its own
+   service (once the pipe fills), never the rest of them.  If
+   the log/ directory can't be created, services write to our
+   own standard output and error, as they always used to.
+
  */
 
 #include "rig.h"
@@ -39,40 +55,194 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <dirent.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
 
 #define PROGRAM "supervise"
 
-#define MAX_SERVICES 5000
+#define MAX_SERVICES 65536
 #define MAX_FILENAME 8192
 #define MIN_FILENAME 3
+#define RESCAN       2 /* seconds between rescans */
+#define LOG_DIR      "log"
+#define LOG_ROTATE   "16m" /* logto -s */
 
-struct {
+static struct service {
 	dev_t dev;
 	ino_t ino;
 	pid_t pid;
-} services[MAX_SERVICES];
-int nservices = 0;
-char path[MAX_FILENAME];
+	pid_t logger; /* logto, reading from log[0] */
+	int   log[2]; /* -1 until (and unless) it has a pipe */
+} *services;
+static int nservices = 0;
+static int capacity = 0; /* grows (doubling) up to MAX_SERVICES */
+
+/* (dev, inode) -> services index + 1, open-addressed (linear
+   probing), with twice as many slots as there are services,
+   so that each scan is linear, not quadratic. */
+static int *byinode;
+#define islot(dev,ino) ((((unsigned long)(ino) * 2654435761UL) ^ (unsigned long)(dev)) & (capacity * 2 - 1))
+#define iprobe(s)      (((s) + 1) & (capacity * 2 - 1))
+
+/* pid -> services index, for both services and their logtos,
+   open-addressed the same way, with four slots per service
+   (two pids each), so that reaping doesn't scan. */
+static struct {
+	pid_t pid; /* 0 = empty */
+	int   i;
+} *bypid;
+#define pslot(pid) (((unsigned long)(pid) * 2654435761UL) & (capacity * 4 - 1))
+#define pprobe(s)  (((s) + 1) & (capacity * 4 - 1))
+static int logging = 0;  /* is there a log/ directory? */
+static char path[MAX_FILENAME];
+static sigset_t mask;
+
+static void
+track(pid_t pid, int i)
+{
+	unsigned long s;
+
+	for (s = pslot(pid); bypid[s].pid; s = pprobe(s))
+		;
+	bypid[s].pid = pid;
+	bypid[s].i = i;
+}
+
+/*
+   Forget `pid`, returning the index of its service (or -1).
+   Deletion shifts later entries of the probe run back, so
+   lookups never need tombstones.
+ */
+static int
+untrack(pid_t pid)
+{
+	unsigned long s, next, home;
+	int i;
+
+	if (!capacity) return -1;
+	for (s = pslot(pid); bypid[s].pid != pid; s = pprobe(s))
+		if (!bypid[s].pid) return -1;
+	i = bypid[s].i;
+
+	for (next = pprobe(s); bypid[next].pid; next = pprobe(next)) {
+		home = pslot(bypid[next].pid);
+		/* can bypid[next] move back into the hole at s? */
+		if (((next - home) & (capacity * 4 - 1)) >= ((next - s) & (capacity * 4 - 1))) {
+			bypid[s] = bypid[next];
+			s = next;
+		}
+	}
+	bypid[s].pid = 0;
+	return i;
+}
 
 static int
 find(struct stat *st)
 {
+	unsigned long s;
 	int i;
 
-	for (i = 0; i < nservices; i++)
-		if (services[i].ino == st->st_ino && services[i].dev == st->st_dev)
-			return i;
+	if (capacity)
+		for (s = islot(st->st_dev, st->st_ino); byinode[s]; s = iprobe(s)) {
+			i = byinode[s] - 1;
+			if (services[i].ino == st->st_ino && services[i].dev == st->st_dev)
+				return i;
+		}
 
-	if (nservices == MAX_SERVICES) return -1;
+	if (nservices == capacity) {
+		struct service *grown;
+		int *index;
+		void *pids;
+
+		if (capacity == MAX_SERVICES) return -1;
+		grown = realloc(services, (capacity ? capacity * 2 : 64) * sizeof(*services));
+		if (!grown) return -1;
+		services = grown;
+		index = calloc((capacity ? capacity * 2 : 64) * 2, sizeof(int));
+		if (!index) return -1;
+		pids = calloc((capacity ? capacity * 2 : 64) * 4, sizeof(*bypid));
+		if (!pids) {
+			free(index);
+			return -1;
+		}
+		free(byinode);
+		free(bypid);
+		byinode = index;
+		bypid = pids;
+		capacity = capacity ? capacity * 2 : 64;
+
+		for (i = 0; i < nservices; i++) {
+			for (s = islot(services[i].dev, services[i].ino); byinode[s]; s = iprobe(s))
+				;
+			byinode[s] = i + 1;
+			if (services[i].pid)    track(services[i].pid, i);
+			if (services[i].logger) track(services[i].logger, i);
+		}
+	}
 	i = nservices++;
+	for (s = islot(st->st_dev, st->st_ino); byinode[s]; s = iprobe(s))
+		;
+	byinode[s] = i + 1;
 
 	services[i].dev = st->st_dev;
 	services[i].ino = st->st_ino;
 	services[i].pid = 0;
+	services[i].logger = 0;
+	services[i].log[0] = services[i].log[1] = -1;
 	return i;
 }
 
+/*
+   Give services[i] a log pipe, if it doesn't have one yet, and
+   start up (or restart) the logto reading from it.  If there's
+   no pipe, the service gets our stdout / stderr instead.
+ */
+static void
+logone(int i, const char *bin)
+{
+	char file[MAX_FILENAME], *argv[5];
+	int fds[3];
+	pid_t pid;
+
+	if (!logging) return;
+
+	if (services[i].log[0] < 0) {
+		if (pipe(services[i].log) != 0) {
+			fprintf(stderr, PROGRAM ": failed to set up logging for %s: %s (error %d)\n", bin, strerror(errno), errno);
+			services[i].log[0] = services[i].log[1] = -1;
+			return;
+		}
+		/* only the service and its logto get an end */
+		fcntl(services[i].log[0], F_SETFD, FD_CLOEXEC);
+		fcntl(services[i].log[1], F_SETFD, FD_CLOEXEC);
+	}
+
+	if (services[i].logger == 0) {
+		if (snprintf(file, MAX_FILENAME, LOG_DIR "/%s", bin) >= MAX_FILENAME) {
+			fprintf(stderr, PROGRAM ": log file name for %s is too long\n", bin);
+			return;
+		}
+		argv[0] = "logto";
+		argv[1] = "-s";
+		argv[2] = LOG_ROTATE;
+		argv[3] = file;
+		argv[4] = NULL;
+		fds[0] = services[i].log[0];
+		fds[1] = fds[2] = -1;
+		pid = rig_spawn(PROGRAM, argv, &mask, fds);
+		if (pid < 0) {
+			fprintf(stderr, PROGRAM ": unable to fork(): %s (error %d)\n", strerror(errno), errno);
+			return;
+		}
+		services[i].logger = pid;
+		track(pid, i);
+	}
+}
+
 static void
 runone(const char *bin)
 {
@@ -111,24 +281,26 @@ runone(const char *bin)
 		return;
 	}
 
+	logone(i, bin);
+
 	/* start services[i] if it is not already running */
 	if (services[i].pid == 0) {
 		pid_t pid;
 		char *argv[3];
-
-		pid = fork();
+		int fds[3];
+
+		argv[0] = "always";
+		argv[1] = path;
+		argv[2] = NULL;
+		fds[0] = -1;
+		fds[1] = fds[2] = services[i].log[1];
+		pid = rig_spawn(PROGRAM, argv, &mask, fds);
 		if (pid < 0) {
 			fprintf(stderr, PROGRAM ": unable to fork(): %s (error %d)\n", strerror(errno), errno);
 			return;
 		}
-		if (pid == 0) {
-			argv[0] = "always";
-			argv[1] = path;
-			argv[2] = NULL;
-			execvp(argv[0], argv);
-			exit(EXIT_IN_CHILD);
-		}
 		services[i].pid = pid;
+		track(pid, i);
 	}
 }
 
@@ -154,10 +326,27 @@ runall(void)
 	closedir(d);
 }
 
+/*
+   The service (or logto) running as `pid` has exited; it'll
+   get started again on the next scan.
+ */
+static void
+reaped(pid_t pid)
+{
+	int i;
+
+	i = untrack(pid);
+	if (i < 0) return;
+	if (services[i].pid == pid)
+		services[i].pid = 0;
+	if (services[i].logger == pid)
+		services[i].logger = 0;
+}
+
 static void
 reapall(void)
 {
-	int i, status;
+	int status;
 	pid_t pid;
 
 	for (;;) {
@@ -169,12 +358,45 @@ reapall(void)
 			break;
 		}
 
-		for (i = 0; i < nservices; i++)
-			if (services[i].pid == pid)
-				services[i].pid = 0;
+		rig_trace(exit, pid, status);
+		reaped(pid);
 	}
 }
 
+/*
+   Handlers for the main loop.  Exited services are reaped as
+   soon as we hear about them, but only restarted on the next
+   rescan, so that something that can't even get as far as
+   running `always' doesn't have us fork()ing flat out.
+ */
+static void
+signalled(int fd, unsigned events, void *data)
+{
+	(void)events; (void)data;
+	while (rig_signal(fd) != 0)
+		;
+	reapall();
+}
+
+static void
+rescan(int fd, unsigned events, void *data)
+{
+	(void)events; (void)data;
+	if (rig_ticks(fd) > 0)
+		runall();
+}
+
+static void
+changed(int fd, unsigned events, void *data)
+{
+	char buf[4096];
+
+	(void)events; (void)data;
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+	runall();
+}
+
 static void
 usage(int rc)
 {
@@ -184,7 +406,8 @@ usage(int rc)
 
 int main(int argc, char **argv)
 {
-	int rc;
+	struct stat st;
+	int rc, fd;
 
 	if (argc != 2) usage(EXIT_IMPROPER);
 	if (argv[1][0] == '-') {
@@ -205,10 +428,43 @@ int main(int argc, char **argv)
 		exit(EXIT_RUNTIME);
 	}
 
+	/* two pipe ends per service add up (services get
+	   the usual limit, though; see rig_spawn()) */
+	rig_morefds();
+
+	if ((mkdir(LOG_DIR, 0755) == 0 || errno == EEXIST)
+	 && stat(LOG_DIR, &st) == 0 && S_ISDIR(st.st_mode))
+		logging = 1;
+	else
+		fprintf(stderr, PROGRAM ": not logging to %s/" LOG_DIR "/: %s (error %d)\n", argv[1], strerror(errno), errno);
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	fd = rig_signalfd(&mask);
+	if (fd < 0 || rig_watch(fd, EPOLLIN, signalled, NULL) != 0) {
+		fprintf(stderr, PROGRAM ": failed to set up signal handling: %s (error %d)\n", strerror(errno), errno);
+		exit(EXIT_RUNTIME);
+	}
+
+	fd = rig_timer(CLOCK_MONOTONIC);
+	if (fd < 0 || rig_watch(fd, EPOLLIN, rescan, NULL) != 0
+	 || rig_arm(fd, RESCAN * 1000000000LL, RESCAN * 1000000000LL, 0) != 0) {
+		fprintf(stderr, PROGRAM ": failed to set up rescan timer: %s (error %d)\n", strerror(errno), errno);
+		exit(EXIT_RUNTIME);
+	}
+
+	/* without inotify, new services just wait for a rescan */
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0 || inotify_add_watch(fd, ".", IN_CREATE | IN_MOVED_TO | IN_ATTRIB | IN_CLOSE_WRITE) < 0
+	 || rig_watch(fd, EPOLLIN, changed, NULL) != 0)
+		fprintf(stderr, PROGRAM ": failed to watch %s for new services: %s (error %d)\n", argv[1], strerror(errno), errno);
+
+	runall();
 	for (;;) {
-		reapall();
-		runall();
-		sleep(2);
+		if (rig_dispatch(-1) < 0) {
+			fprintf(stderr, PROGRAM ": epoll_wait() failed: %s (error %d)\n", strerror(errno), errno);
+			exit(EXIT_RUNTIME);
+		}
 	}
 
 	return 0;